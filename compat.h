@@ -19,6 +19,22 @@
 #define GENMASK(h, l)           (((U32_C(1) << ((h) - (l) + 1)) - 1) << (l))
 #endif
 
+/* hrtimer_setup() replaced hrtimer_init() in 6.13 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static inline void hrtimer_setup(struct hrtimer *timer,
+				 enum hrtimer_restart (*function)(struct hrtimer *),
+				 clockid_t clock_id, enum hrtimer_mode mode)
+{
+	hrtimer_init(timer, clock_id, mode);
+	timer->function = function;
+}
+#endif
+
+/* get_random_u32_below() replaced prandom_u32_max() in 6.2 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define get_random_u32_below(ceil)	prandom_u32_max(ceil)
+#endif
+
 /* It seems that fairly recently, Ubuntu added these functions to their headers in include/linux/hid.h 
 or something else happened? */
 #if 0
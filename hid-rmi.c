@@ -19,7 +19,22 @@
 #include <linux/slab.h>
 #include <linux/wait.h>
 #include <linux/bitops.h>
+#include <linux/bitmap.h>
 #include <linux/sched.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/i2c.h>
+#include <linux/interrupt.h>
+#include <linux/pm_runtime.h>
+#include <linux/atomic.h>
+#include <linux/delay.h>
+#include <linux/firmware.h>
+#include <linux/hrtimer.h>
+#include <linux/random.h>
+#include <linux/ratelimit.h>
 #include "hid-ids.h"
 
 #include "compat.h"
@@ -31,10 +46,178 @@
 #define RMI_ATTN_REPORT_ID		0x0c /* Input Report */
 #define RMI_SET_RMI_MODE_REPORT_ID	0x0f /* Feature Report */
 
-/* flags */
-#define RMI_READ_REQUEST_PENDING	BIT(0)
-#define RMI_READ_DATA_PENDING		BIT(1)
-#define RMI_STARTED			BIT(2)
+/* flags, bit numbers for the bitops */
+#define RMI_READ_REQUEST_PENDING	0
+#define RMI_READ_DATA_PENDING		1
+#define RMI_STARTED			2
+#define RMI_OPENED			3
+#define RMI_WAKE_ARMED			4
+#define RMI_WAKE_PENDING		5
+#define RMI_SCRATCH			6
+#define RMI_ATTN_DEFERRED		7
+
+/* shadow of the control registers, big enough for F01, F11 and F30 */
+#define RMI_CTRL_CACHE_SIZE		48
+
+/* F01 device control register */
+#define RMI_F01_CTRL0_SLEEP_MASK	0x03
+#define RMI_F01_CTRL0_SLEEP_NORMAL	0x00
+#define RMI_F01_CTRL0_SLEEP_SENSOR	0x01
+#define RMI_F01_CTRL0_NOSLEEP		BIT(2)
+
+/* F01 device command and status */
+#define RMI_F01_CMD_RESET		BIT(0)
+#define RMI_F01_STATUS_CODE_MASK	0x0f
+#define RMI_F01_STATUS_BOOTLOADER	BIT(6)
+#define RMI_F01_RESET_DELAY_MS		100
+
+/* F11 2D control registers, relative to the control base */
+#define RMI_F11_CTRL_REPORT_MODE	0
+#define RMI_F11_CTRL_DELTA_X		2
+#define RMI_F11_CTRL_DELTA_Y		3
+#define RMI_F11_CTRL_PALM		1
+#define RMI_F11_CTRL_GESTURE_EN1	10	/* present if query 7 != 0 */
+
+/* F11 control 0 */
+#define RMI_F11_CTRL0_REPORT_MODE_MASK	0x07
+#define RMI_F11_CTRL0_REPORT_REDUCED	0x01	/* report motion past delta */
+
+/* F11 control 1 */
+#define RMI_F11_CTRL1_PALM_THRESHOLD	0x0f
+
+/* F11 control 11 and gesture flags 1 */
+#define RMI_F11_GESTURE2_PALM		BIT(0)
+
+/* F11 gestures, the bits of query 7, control 10 and gesture flags 0 */
+#define RMI_F11_GESTURE_SINGLE_TAP	BIT(0)
+#define RMI_F11_GESTURE_TAP_AND_HOLD	BIT(1)
+#define RMI_F11_GESTURE_DOUBLE_TAP	BIT(2)
+#define RMI_F11_GESTURE_EARLY_TAP	BIT(3)
+#define RMI_F11_GESTURE_FLICK		BIT(4)
+#define RMI_F11_GESTURE_PRESS		BIT(5)
+#define RMI_F11_GESTURE_PINCH		BIT(6)
+#define RMI_F11_GESTURE_MASK		0x7f
+
+/* F11 query 8 */
+#define RMI_F11_QUERY8_PALM_DETECT	BIT(0)
+#define RMI_F11_QUERY8_ROTATE		BIT(1)
+#define RMI_F11_QUERY8_QUERY10		BIT(2)
+
+/* minimal motion reported while the rate is lowered */
+#define RMI_RATE_SLOW_DELTA_MM		1
+
+/* continuation reports of an attention frame come back to back */
+#define RMI_ATTN_CONT_TIMEOUT_NS	(20 * NSEC_PER_MSEC)
+
+/* a frame this long after resume did not wake us */
+#define RMI_WAKE_WINDOW_NS		(1000 * NSEC_PER_MSEC)
+
+static unsigned int open_budget_ms = 50;
+module_param(open_budget_ms, uint, 0644);
+MODULE_PARM_DESC(open_budget_ms, "Wake-up latency budget on first open (ms)");
+
+static unsigned int autosuspend_ms = 2000;
+module_param(autosuspend_ms, uint, 0444);
+MODULE_PARM_DESC(autosuspend_ms, "Runtime PM autosuspend delay of native transports (ms)");
+
+static bool scroll_offload;
+module_param(scroll_offload, bool, 0444);
+MODULE_PARM_DESC(scroll_offload, "Report two-finger scroll as hi-res wheel events on a secondary input device");
+
+static bool threaded_decode;
+module_param(threaded_decode, bool, 0444);
+MODULE_PARM_DESC(threaded_decode, "Decode HID attention reports in a high priority work instead of the transport completion");
+
+enum rmi_poll_mode {
+	RMI_POLL_OFF,
+	RMI_POLL_AUTO,
+	RMI_POLL_ALWAYS,
+};
+
+static int poll_mode_set(const char *val, const struct kernel_param *kp)
+{
+	int mode;
+	int ret;
+
+	ret = kstrtoint(val, 0, &mode);
+	if (ret)
+		return ret;
+
+	if (mode < RMI_POLL_OFF || mode > RMI_POLL_ALWAYS)
+		return -EINVAL;
+
+	return param_set_int(val, kp);
+}
+
+static const struct kernel_param_ops poll_mode_ops = {
+	.set	= poll_mode_set,
+	.get	= param_get_int,
+};
+
+static int poll_mode;
+module_param_cb(poll_mode, &poll_mode_ops, &poll_mode, 0444);
+MODULE_PARM_DESC(poll_mode, "Read the sensor on a timer: 0 never, 1 when attention goes silent, 2 always");
+
+/* faster than the sensor reports only spins the timer */
+#define RMI_POLL_MIN_INTERVAL_US	1000
+#define RMI_POLL_MAX_INTERVAL_US	USEC_PER_SEC
+
+static int poll_interval_set(const char *val, const struct kernel_param *kp)
+{
+	unsigned int interval;
+	int ret;
+
+	ret = kstrtouint(val, 0, &interval);
+	if (ret)
+		return ret;
+
+	if (interval < RMI_POLL_MIN_INTERVAL_US ||
+	    interval > RMI_POLL_MAX_INTERVAL_US)
+		return -EINVAL;
+
+	return param_set_uint(val, kp);
+}
+
+static const struct kernel_param_ops poll_interval_ops = {
+	.set	= poll_interval_set,
+	.get	= param_get_uint,
+};
+
+static unsigned int poll_interval_us = 12500;
+module_param_cb(poll_interval_us, &poll_interval_ops, &poll_interval_us,
+		0644);
+MODULE_PARM_DESC(poll_interval_us, "Period of the polling mode, 1000-1000000 (us)");
+
+static unsigned int poll_silence_ms = 1000;
+module_param(poll_silence_ms, uint, 0644);
+MODULE_PARM_DESC(poll_silence_ms, "Attention silence checked for lost reports, and polling idle time before returning to attention (ms)");
+
+static unsigned int fw_gestures;
+module_param(fw_gestures, uint, 0444);
+MODULE_PARM_DESC(fw_gestures, "Gestures detected by the firmware, reported as MSC_GESTURE (mask of F11 query 7: 0x01 tap, 0x02 tap and hold, 0x04 double tap, 0x08 early tap, 0x10 flick, 0x20 press, 0x40 pinch)");
+
+static int palm_threshold = -1;
+module_param(palm_threshold, int, 0444);
+MODULE_PARM_DESC(palm_threshold, "Firmware palm rejection: -1 keeps the firmware setting, 0 turns it off, 1-15 turns it on with this F11 palm detect threshold");
+
+static bool adaptive_rate;
+module_param(adaptive_rate, bool, 0444);
+MODULE_PARM_DESC(adaptive_rate, "Lower the report rate while the contacts are still");
+
+static unsigned int idle_delay_ms = 300;
+module_param(idle_delay_ms, uint, 0644);
+MODULE_PARM_DESC(idle_delay_ms, "Time without motion before the report rate is lowered (ms)");
+
+#define RMI_MAX_FINGERS			10
+
+/* F11 query 0 counts up to 8 sensors, the first ones are handled */
+#define RMI_F11_MAX_SENSORS		4
+
+/* two-finger scroll, distances in mm of the sensor surface */
+#define RMI_SCROLL_START_MM		2
+#define RMI_SCROLL_DETENT_MM		8
+#define RMI_SCROLL_FALLBACK_SIZE_MM	100
+#define RMI_WHEEL_HI_RES_DETENT		120
 
 enum rmi_mode_type {
 	RMI_MODE_OFF 			= 0,
@@ -54,30 +237,499 @@ struct rmi_function {
 	unsigned int report_size;	/* size of a report */
 	unsigned long irq_mask;		/* mask of the interrupts
 					 * (to be applied against ATTN IRQ) */
+	u8 ctrl[RMI_CTRL_CACHE_SIZE];	/* cache of the control registers */
+	unsigned int ctrl_size;		/* number of cached control registers */
+	DECLARE_BITMAP(ctrl_dirty, RMI_CTRL_CACHE_SIZE);
+					/* cached registers the driver wrote */
+};
+
+struct rmi_data;
+
+struct rmi_slot {
+	bool active;
+	int x;
+	int y;
+	int motion_x;	/* position when motion was last counted */
+	int motion_y;
+};
+
+/**
+ * struct rmi_f11_sensor - one 2D sensor of F11
+ *
+ * @input: input device reporting the contacts of the sensor
+ * @ctrl_offset: first control register of the sensor, from the F11 base
+ * @ctrl_size: number of cached control registers of the sensor, 0 if they
+ *	can not be located
+ * @data_offset: data of the sensor in the F11 attention block
+ * @report_size: size of the data of the sensor
+ * @abs_offset: first finger position, after the finger states
+ * @max_fingers: maximum finger count reported by the sensor
+ * @max_x: maximum x value reported by the sensor
+ * @max_y: maximum y value reported by the sensor
+ * @x_size_mm: physical width of the sensor, 0 if unknown
+ * @y_size_mm: physical height of the sensor, 0 if unknown
+ * @gesture_query: query 7 and 8, the gestures the firmware can detect
+ * @gesture_offset: gesture data in the data of the sensor
+ * @gestures: gestures enabled in the firmware and reported as MSC_GESTURE
+ * @palm_detect: the firmware suppresses palm contacts and flags them
+ * @palm: a palm was flagged in the last frame
+ * @motion_x: smallest displacement counted as motion by the rate policy
+ * @motion_y: same as @motion_x, vertically
+ * @slots: state of each contact in the last frame
+ */
+struct rmi_f11_sensor {
+	struct input_dev *input;
+	unsigned int ctrl_offset;
+	unsigned int ctrl_size;
+	unsigned int data_offset;
+	unsigned int report_size;
+	unsigned int abs_offset;
+	unsigned int max_fingers;
+	unsigned int max_x;
+	unsigned int max_y;
+	unsigned int x_size_mm;
+	unsigned int y_size_mm;
+	u8 gesture_query[2];
+	unsigned int gesture_offset;
+	u8 gestures;
+	bool palm_detect;
+	bool palm;
+	unsigned int motion_x;
+	unsigned int motion_y;
+	struct rmi_slot slots[RMI_MAX_FINGERS];
+};
+
+/**
+ * struct rmi_scroll - in-kernel two-finger scroll recognition
+ *
+ * @input: secondary input device reporting the wheel events
+ * @units_x: sensor units per mm, horizontally
+ * @units_y: sensor units per mm, vertically
+ * @tracking: exactly two contacts are down
+ * @scrolling: the contacts moved past RMI_SCROLL_START_MM
+ * @start_x: centroid when the second contact landed
+ * @start_y: centroid when the second contact landed
+ * @last_x: centroid in the previous frame
+ * @last_y: centroid in the previous frame
+ * @open: the scroll device is open, the main device hides the scrolling
+ *	contacts
+ * @acc_x: motion not yet reported as hi-res wheel, in sensor units times
+ *	RMI_WHEEL_HI_RES_DETENT
+ * @acc_y: same as @acc_x, vertically
+ * @hires_x: hi-res wheel not yet reported as a full detent
+ * @hires_y: hi-res wheel not yet reported as a full detent
+ */
+struct rmi_scroll {
+	struct input_dev *input;
+	int units_x;
+	int units_y;
+	bool tracking;
+	bool scrolling;
+	bool open;
+	int start_x;
+	int start_y;
+	int last_x;
+	int last_y;
+	int acc_x;
+	int acc_y;
+	int hires_x;
+	int hires_y;
+};
+
+enum rmi_rate_mode {
+	RMI_RATE_FAST,
+	RMI_RATE_SLOW,
+	RMI_RATE_MODES,
+};
+
+struct rmi_rate_stats {
+	u64 frames[RMI_RATE_MODES];
+	u64 mode_ns[RMI_RATE_MODES];
+	u64 switches;
+	u64 switch_last_ns;
+	u64 switch_max_ns;
+	u64 switch_xfers;
+	u64 switch_xfers_last;
+	u64 onset_last_ns;
+	u64 onset_max_ns;
+	u64 errors;
+};
+
+/**
+ * struct rmi_rate - adaptive report rate
+ *
+ * @enabled: the device has the registers the policy needs
+ * @mode: reporting parameters currently programmed in the device
+ * @work: applies the mode switches and detects the idle periods
+ * @last_motion: jiffies of the last frame with moving contacts
+ * @onset_ns: first motion frame received while the rate was lowered
+ * @since_ns: when the current mode was entered
+ * @report_mode: F11 reporting mode (control 0) of each mode
+ * @delta: F11 delta X/Y thresholds of each mode
+ * @stats: frames and time spent in each mode, switching costs
+ */
+struct rmi_rate {
+	bool enabled;
+	enum rmi_rate_mode mode;
+	struct delayed_work work;
+	unsigned long last_motion;
+	u64 onset_ns;
+	u64 since_ns;
+	u8 report_mode[RMI_RATE_MODES];
+	u8 delta[RMI_RATE_MODES][2];
+	struct rmi_rate_stats stats;
+};
+
+/**
+ * struct rmi_flash - F34 reflash geometry and timings of the last update
+ *
+ * @bootloader_id: key unlocking the flash commands
+ * @block_size: bytes per flash block
+ * @fw_blocks: firmware blocks
+ * @cfg_blocks: configuration blocks
+ * @result: outcome of the last update
+ * @total_ns: duration of the last update, reset included
+ * @enable_ns: time to enter the bootloader
+ * @erase_ns: time to erase the flash
+ * @write_ns: time to write the firmware and configuration blocks
+ * @verify_ns: time to read back the configuration
+ * @reset_ns: time to restart and rediscover the device
+ * @polls: status reads needed to complete the commands
+ */
+struct rmi_flash {
+	u8 bootloader_id[2];
+	u16 block_size;
+	u16 fw_blocks;
+	u16 cfg_blocks;
+	int result;
+	u64 total_ns;
+	u64 enable_ns;
+	u64 erase_ns;
+	u64 write_ns;
+	u64 verify_ns;
+	u64 reset_ns;
+	u64 polls;
+};
+
+/* largest register span read in one go by the polling mode */
+#define RMI_POLL_MAX_SPAN		64
+
+struct rmi_poll_stats {
+	u64 attn_frames;
+	u64 watch_reads;
+	u64 watch_bytes;
+	u64 ticks;
+	u64 frames;
+	u64 bytes;
+	u64 bus_ns;
+	u64 attn_ns;
+	u64 poll_ns;
+	u64 to_poll;
+	u64 to_attn;
+};
+
+/**
+ * struct rmi_poll - polling mode, for units losing their attention reports
+ *
+ * @enabled: poll_mode applies to this device
+ * @active: the sensor is being polled
+ * @timer: ticks of the polling mode
+ * @work: reads and decodes the sensor for a tick
+ * @watch: looks for data left behind by a silent attention line
+ * @lock: serializes the decoding of polled and attention frames
+ * @watch_attn: attention frames received at the previous watchdog check
+ * @last_data_ns: last tick which found data
+ * @since_ns: when the current mode was entered
+ * @status_addr: first F01 interrupt status register
+ * @span_base: first register of the batched read
+ * @span_len: length of the batched read, 0 if the blocks are too far apart
+ * @span: buffer of the batched read
+ * @frame: attention frame rebuilt from @span
+ * @stats: bus cost of each mode and switches
+ */
+struct rmi_poll {
+	bool enabled;
+	bool active;
+	struct hrtimer timer;
+	struct work_struct work;
+	struct delayed_work watch;
+	spinlock_t lock;
+	u64 watch_attn;
+	u64 last_data_ns;
+	u64 since_ns;
+	u16 status_addr;
+	u16 span_base;
+	int span_len;
+	u8 *span;
+	u8 *frame;
+	struct rmi_poll_stats stats;
+};
+
+struct rmi_attn_stats {
+	u64 frames;
+	u64 decode_ns;
+	u64 decode_max_ns;
+	u64 short_frames;
+	u64 reassembled_frames;
+	u64 incomplete_frames;
+	u64 irq_frames;
+	u64 irq_ns;
+	u64 irq_max_ns;
+	u64 latency_frames;
+	u64 latency_ns;
+	u64 latency_max_ns;
+	u64 overruns;
+	u64 gestures;
+	u64 palms;
+	u64 palm_frames;
+};
+
+/* attention frames in flight to the decode work, a power of two */
+#define RMI_RING_SIZE			16
+
+struct rmi_ring_slot {
+	u64 ts;
+	int len;
+	u8 *data;
+};
+
+/**
+ * struct rmi_ring - single producer, single consumer ring of attention
+ *	frames, from the transport completion to the decode work
+ *
+ * @enabled: attention frames are decoded by @work
+ * @head: next slot written, only advanced by the producer
+ * @tail: next slot read, only advanced by the consumer
+ * @slots: the frames and when they were received
+ * @work: decodes the frames, on the high priority workqueue
+ */
+struct rmi_ring {
+	bool enabled;
+	unsigned int head;
+	unsigned int tail;
+	struct rmi_ring_slot slots[RMI_RING_SIZE];
+	struct work_struct work;
+};
+
+/*
+ * Reports the driver drops on the hot paths. They are only counted there,
+ * a summary is logged at most once per RMI_EVENT_LOG_INTERVAL.
+ */
+#define RMI_EVENT_LOG_INTERVAL		(10 * HZ)
+
+struct rmi_event_stats {
+	u64 unknown_irq;
+	unsigned long unknown_irq_mask;
+	u64 stray_reads;
+	u64 short_reads;
+};
+
+enum rmi_fault_report {
+	RMI_FAULT_READ,
+	RMI_FAULT_ATTN,
+	RMI_FAULT_REPORTS
+};
+
+struct rmi_fault_stats {
+	u64 reports;
+	u64 dropped;
+	u64 truncated;
+	u64 delayed;
+	u64 resets;
+};
+
+/*
+ * Faults injected in one type of input report, see debugfs "faults". The
+ * percentages are cumulative: a single roll per report picks at most one.
+ */
+struct rmi_fault {
+	struct rmi_data *data;
+	unsigned int drop;
+	unsigned int truncate;
+	unsigned int delay;
+	unsigned int reset;
+	unsigned int delay_ms;
+	struct delayed_work work;
+	u8 *held;
+	int held_len;
+	struct rmi_fault_stats stats;
+};
+
+struct rmi_recovery_stats {
+	u64 read_retries;
+	u64 read_recoveries;
+	u64 read_recover_ns;
+	u64 read_recover_max_ns;
+	u64 read_failures;
+	u64 resets;
+	u64 reset_ns;
+	u64 reset_max_ns;
+	/* attn_stats when the fault profile was set */
+	u64 base_frames;
+	u64 base_short;
+	u64 base_incomplete;
+};
+
+struct rmi_pm_stats {
+	u64 opens;
+	u64 open_last_ns;
+	u64 open_max_ns;
+	u64 open_over_budget;
+	u64 suspends;
+	u64 suspend_last_ns;
+	u64 resumes;
+	u64 resume_last_ns;
+	u64 resume_max_ns;
+	u64 wake_frames;
+	u64 wake_suspend_ns;		/* boottime */
+	u64 wake_frame_ns;		/* boottime */
+	u64 wake_resume_ns;		/* boottime */
+};
+
+enum rmi_xfer_state {
+	RMI_XFER_RUNNING,
+	RMI_XFER_QUIESCED,	/* suspending: urgent transactions only */
+	RMI_XFER_DYING,		/* unbinding: no transaction at all */
+};
+
+struct rmi_xfer_stats {
+	u64 reads;
+	u64 read_bytes;
+	u64 read_ns;
+	u64 writes;
+	u64 write_bytes;
+	u64 write_ns;
+	u64 page_switches;
+	u64 errors;
+	u64 aborts;
+	u64 rejected;
+	u64 preemptions;
+	u64 urgent_wait_ns;
+	u64 urgent_wait_max_ns;
+};
+
+/* transactions of the HID transport in flight at once, up to BITS_PER_LONG */
+#define RMI_XFER_POOL_SIZE		4
+
+/**
+ * struct rmi_xfer - one HID register transaction
+ *
+ * @out: output report, output_report_size bytes
+ * @in: input report, input_report_size bytes, filled by the read data
+ *	completion while the transaction is the pending read
+ */
+struct rmi_xfer {
+	u8 *out;
+	u8 *in;
+};
+
+/**
+ * struct rmi_xfer_pool - transactions and report buffers allocated at probe
+ *
+ * @free: bitmap of the free @xfers, taken and given back without a lock
+ * @wait: tasks waiting for a free transaction
+ * @waits: times the pool was found empty
+ * @xfers: the transactions, their reports share one allocation
+ */
+struct rmi_xfer_pool {
+	unsigned long free;
+	wait_queue_head_t wait;
+	u64 waits;
+	struct rmi_xfer xfers[RMI_XFER_POOL_SIZE];
+};
+
+/* flight recorder of the register traffic, a power of two */
+#define RMI_TRACE_SIZE			256
+
+enum rmi_trace_type {
+	RMI_TRACE_READ,		/* register block read */
+	RMI_TRACE_WRITE,	/* register block write */
+	RMI_TRACE_PAGE,		/* page select, addr is 0xff of the new page */
+	RMI_TRACE_OUT,		/* HID output report sent */
+	RMI_TRACE_IN,		/* HID input report received */
+	RMI_TRACE_TIMEOUT,	/* no read data report in time */
+};
+
+/*
+ * One recorded event, 16 bytes. @ts is the CLOCK_MONOTONIC time the event
+ * started (transactions) or was seen (reports), @result the transfer
+ * status, @report_id is 0 for events which are not HID reports. @addr is
+ * the full 16-bit register address, page included.
+ */
+struct rmi_trace_entry {
+	u64 ts;
+	s16 result;
+	u16 addr;
+	u16 len;
+	u8 type;
+	u8 report_id;
+};
+
+/**
+ * struct rmi_transport_ops - bus access used by the RMI function layer
+ *
+ * @name: short name of the transport, for diagnostics
+ * @read_block: read @len bytes starting at @addr. The page of @addr has
+ *	already been selected and xfer_mutex is held. Waits should give up
+ *	with -ECANCELED once rmi_xfer_aborted() is true.
+ * @write_block: write @len bytes starting at @addr, same rules as
+ *	@read_block. @len never exceeds rmi_data.max_write_size.
+ * @set_mode: switch the reporting mode of the device (optional)
+ * @open: power up the transport and start delivering incoming data; needed
+ *	before any register access outside of probe (optional)
+ * @close: counterpart of @open (optional)
+ *
+ * Interrupts travel the other way: the transport hands every attention
+ * frame (RMI_ATTN_REPORT_ID layout) to rmi_input_event().
+ */
+struct rmi_transport_ops {
+	const char *name;
+	int (*read_block)(struct rmi_data *data, u16 addr, void *buf,
+			const int len);
+	int (*write_block)(struct rmi_data *data, u16 addr, const void *buf,
+			const int len);
+	int (*set_mode)(struct rmi_data *data, u8 mode);
+	int (*open)(struct rmi_data *data);
+	void (*close)(struct rmi_data *data);
 };
 
 /**
  * struct rmi_data - stores information for hid communication
  *
- * @page_mutex: Locks current page to avoid changing pages in unexpected ways.
+ * @page_mutex: protects @page and the control register caches, never held
+ *	across a bus transfer
  * @page: Keeps track of the current virtual page
  *
+ * @xfer_mutex: one register transaction at a time on the bus
+ * @xfer_wait: normal transactions waiting for the urgent ones
+ * @urgent_mutex: serializes the urgent sections
+ * @urgent: urgent sections started or waiting
+ * @urgent_task: task running the urgent section, its transactions go first
+ * @xfer_abort: the normal transaction in flight must give up
+ * @xfer_state: enum rmi_xfer_state, which transactions are accepted
+ *
+ * @xport: register access operations of the underlying transport
+ * @xport_priv: private data of the transport
+ * @max_write_size: largest block the transport can write in one transfer
+ *
  * @wait: Used for waiting for read data
  *
- * @writeReport: output buffer when writing RMI registers
- * @readReport: input buffer when reading RMI registers
+ * @pool: report buffers of the HID register transactions
+ * @xfer_read: transaction of the pending read, receives the read data
  *
  * @input_report_size: size of an input report (advertised by HID)
  * @output_report_size: size of an output report (advertised by HID)
  *
  * @flags: flags for the current device (started, reading, etc...)
  *
+ * @f01: placeholder of internal RMI function F01 description
  * @f11: placeholder of internal RMI function F11 description
  * @f30: placeholder of internal RMI function F30 description
+ * @f34: placeholder of internal RMI function F34 (flash) description
+ * @irq_count: number of interrupt sources in the device
  *
- * @max_fingers: maximum finger count reported by the device
- * @max_x: maximum x value reported by the device
- * @max_y: maximum y value reported by the device
+ * @sensors: the 2D sensors of F11, the first one reports on @input
+ * @sensor_count: number of sensors in @sensors
  *
  * @gpio_led_count: count of GPIOs + LEDs reported by F30
  * @button_count: actual physical buttons count
@@ -85,32 +737,84 @@ struct rmi_function {
  * @button_state_mask: pull state of the buttons
  *
  * @input: pointer to the kernel input device
+ * @open_mutex: serializes the first open and the last close
+ * @open_count: number of open input devices (main, scroll, other sensors)
+ * @scroll: two-finger scroll offload state
+ * @rate: adaptive report rate state
+ * @poll: polling mode state
+ * @ring: frames queued for threaded decoding
  *
  * @reset_work: worker which will be called in case of a mouse report
  * @hdev: pointer to the struct hid_device
+ * @dev: device used for diagnostics
+ *
+ * @attn_frame: buffer for attention frames read from the data registers
+ *	(I2C) or reassembled from several reports (HID)
+ * @attn_len: bytes of the frame being reassembled received so far
+ * @attn_need: size of the frame being reassembled, 0 if none
+ * @attn_ts: when the last piece of that frame was received
+ * @attn_timer: drops the frame being reassembled if the rest never comes
+ * @attn_lock: protects the reassembly state against @attn_timer
+ *
+ * @probe_ns: time spent in probe
+ * @populate_ns: time spent discovering the device at probe
+ * @xfer_stats: register traffic counters, protected by xfer_mutex
+ * @attn_stats: attention decode counters, updated by the attention path
+ * @pm_stats: open/close and power management timings
+ * @event_stats: reports dropped by the attention and read paths
+ * @event_rs: ratelimit of the @event_stats summary
+ * @faults: faults injected in the read data and attention reports (HID)
+ * @faults_armed: one of @faults has a non zero probability
+ * @event_lock: serializes the input reports with the replays of @faults
+ * @recovery_stats: read retries and resets, the cost of lost reports
+ * @reset_start_ns: when the pending reset_work was scheduled, 0 if none
+ * @wake_ctrl0: F01 device control to restore after a wake-on-touch suspend
+ * @wake_dev: device with the wakeup source accounting the wake events
+ * @trace_head: number of events ever recorded in @trace
+ * @trace: ring of the last RMI_TRACE_SIZE transactions and reports
+ * @pdt_page_count: number of pages holding PDT entries
+ * @debugfs: per device debugfs directory
+ * @regs_mutex: serializes raw register access and reflash from debugfs
+ * @regs_out: result of the last batch written to regs
+ * @regs_len: length of @regs_out
+ * @flash: F34 reflash geometry and statistics
+ * @mock_regs: register image used by the mock transport benchmark
+ * @scale_devices: largest device count of the scaling benchmark
  */
 struct rmi_data {
 	struct mutex page_mutex;
 	int page;
 
+	struct mutex xfer_mutex;
+	wait_queue_head_t xfer_wait;
+	struct mutex urgent_mutex;
+	atomic_t urgent;
+	struct task_struct *urgent_task;
+	bool xfer_abort;
+	int xfer_state;
+
+	const struct rmi_transport_ops *xport;
+	void *xport_priv;
+	int max_write_size;
+
 	wait_queue_head_t wait;
 
-	u8 *writeReport;
-	u8 *readReport;
+	struct rmi_xfer_pool pool;
+	struct rmi_xfer *xfer_read;
 
 	int input_report_size;
 	int output_report_size;
 
 	unsigned long flags;
 
+	struct rmi_function f01;
 	struct rmi_function f11;
 	struct rmi_function f30;
+	struct rmi_function f34;
+	unsigned int irq_count;
 
-	unsigned int max_fingers;
-	unsigned int max_x;
-	unsigned int max_y;
-	unsigned int x_size_mm;
-	unsigned int y_size_mm;
+	struct rmi_f11_sensor sensors[RMI_F11_MAX_SENSORS];
+	unsigned int sensor_count;
 
 	unsigned int gpio_led_count;
 	unsigned int button_count;
@@ -118,18 +822,254 @@ struct rmi_data {
 	unsigned long button_state_mask;
 
 	struct input_dev *input;
+	struct mutex open_mutex;
+	int open_count;
+	struct rmi_scroll scroll;
+	struct rmi_rate rate;
+	struct rmi_poll poll;
+	struct rmi_ring ring;
 
 	struct work_struct reset_work;
 	struct hid_device *hdev;
+	struct device *dev;
+
+	u8 *attn_frame;
+	int attn_len;
+	int attn_need;
+	u64 attn_ts;
+	struct hrtimer attn_timer;
+	spinlock_t attn_lock;
+
+	u64 probe_ns;
+	u64 populate_ns;
+	struct rmi_xfer_stats xfer_stats;
+	struct rmi_attn_stats attn_stats;
+	struct rmi_pm_stats pm_stats;
+	struct rmi_event_stats event_stats;
+	struct ratelimit_state event_rs;
+	struct rmi_fault faults[RMI_FAULT_REPORTS];
+	bool faults_armed;
+	spinlock_t event_lock;
+	struct rmi_recovery_stats recovery_stats;
+	u64 reset_start_ns;
+	u8 wake_ctrl0;
+	struct device *wake_dev;
+	atomic_t trace_head;
+	struct rmi_trace_entry trace[RMI_TRACE_SIZE];
+	int pdt_page_count;
+	struct dentry *debugfs;
+	struct mutex regs_mutex;
+	char *regs_out;
+	size_t regs_len;
+	struct rmi_flash flash;
+	u8 *mock_regs;
+	unsigned int scale_devices;
 };
 
 #define RMI_PAGE(addr) (((addr) >> 8) & 0xff)
+#define RMI_PAGE_SELECT_REGISTER	0xff
+
+/*
+ * Logging of the discovery and decode paths. The scratch devices of the
+ * benchmarks log through the device they copy, they are kept quiet and
+ * report their errors through the benchmark result instead.
+ */
+#define rmi_log(func, data, fmt, ...)					\
+do {									\
+	if (!test_bit(RMI_SCRATCH, &(data)->flags))			\
+		func((data)->dev, fmt, ##__VA_ARGS__);			\
+} while (0)
+#define rmi_err(data, fmt, ...)	rmi_log(dev_err, data, fmt, ##__VA_ARGS__)
+#define rmi_warn(data, fmt, ...) rmi_log(dev_warn, data, fmt, ##__VA_ARGS__)
+#define rmi_info(data, fmt, ...) rmi_log(dev_info, data, fmt, ##__VA_ARGS__)
+
+static struct dentry *rmi_debugfs_root;
+
+/*
+ * Reset, report rate and attention watch works of every device. Unbound,
+ * so that many devices do not queue up on the CPU taking their interrupts.
+ */
+static struct workqueue_struct *rmi_wq;
+
+/*
+ * Record an event in the flight recorder. Writers only claim a slot, so
+ * this is safe from any context; a reader racing with a writer may see a
+ * torn entry, which is fine for a post-mortem dump.
+ */
+static inline void rmi_trace(struct rmi_data *data, u8 type, u8 report_id,
+		u16 addr, u16 len, int result, u64 ts)
+{
+	unsigned int i = atomic_inc_return(&data->trace_head) - 1;
+	struct rmi_trace_entry *e = &data->trace[i & (RMI_TRACE_SIZE - 1)];
+
+	e->ts = ts;
+	e->result = result;
+	e->addr = addr;
+	e->len = len;
+	e->type = type;
+	e->report_id = report_id;
+}
+
+/*
+ * Register transactions. A stalled sensor can keep a HID read waiting for
+ * seconds, so the bus is owned through xfer_mutex only, the page and the
+ * caches have their own lock, and the power management paths run as
+ * urgent sections: they abort the normal transaction in flight, and
+ * normal transactions wait until they are done.
+ */
+static void rmi_xfer_init(struct rmi_data *data)
+{
+	mutex_init(&data->page_mutex);
+	mutex_init(&data->xfer_mutex);
+	mutex_init(&data->urgent_mutex);
+	mutex_init(&data->open_mutex);
+	init_waitqueue_head(&data->wait);
+	init_waitqueue_head(&data->xfer_wait);
+	atomic_set(&data->urgent, 0);
+}
+
+static inline bool rmi_xfer_urgent(struct rmi_data *data)
+{
+	return READ_ONCE(data->urgent_task) == current;
+}
+
+static inline bool rmi_xfer_rejected(struct rmi_data *data)
+{
+	int state = READ_ONCE(data->xfer_state);
+
+	return state == RMI_XFER_DYING ||
+	       (state == RMI_XFER_QUIESCED && !rmi_xfer_urgent(data));
+}
+
+/* true when the waiting transaction must give up */
+static inline bool rmi_xfer_aborted(struct rmi_data *data)
+{
+	return rmi_xfer_rejected(data) ||
+	       (READ_ONCE(data->xfer_abort) && !rmi_xfer_urgent(data));
+}
+
+/*
+ * Leaving RMI_XFER_RUNNING fails the transactions waiting for read data or
+ * for the bus right away, whatever state the sensor is in, so that
+ * suspend and unbind never wait for its timeouts.
+ */
+static void rmi_xfer_set_state(struct rmi_data *data, int state)
+{
+	WRITE_ONCE(data->xfer_state, state);
+	if (state == RMI_XFER_RUNNING)
+		return;
+
+	wake_up_all(&data->wait);
+	wake_up_all(&data->xfer_wait);
+}
+
+static int rmi_xfer_lock(struct rmi_data *data)
+{
+	struct rmi_xfer_stats *stats = &data->xfer_stats;
+	u64 start, elapsed;
+
+	if (rmi_xfer_rejected(data)) {
+		stats->rejected++;
+		return -ESHUTDOWN;
+	}
+
+	if (rmi_xfer_urgent(data)) {
+		start = ktime_get_ns();
+		mutex_lock(&data->xfer_mutex);
+		WRITE_ONCE(data->xfer_abort, false);
+
+		elapsed = ktime_get_ns() - start;
+		stats->urgent_wait_ns += elapsed;
+		if (elapsed > stats->urgent_wait_max_ns)
+			stats->urgent_wait_max_ns = elapsed;
+		return 0;
+	}
+
+	/*
+	 * Not interruptible: probe and populate run here too, and a stalled
+	 * transfer is already cut short by rmi_xfer_aborted().
+	 */
+	for (;;) {
+		wait_event(data->xfer_wait, !atomic_read(&data->urgent) ||
+			   rmi_xfer_rejected(data));
+		mutex_lock(&data->xfer_mutex);
+
+		if (rmi_xfer_rejected(data)) {
+			mutex_unlock(&data->xfer_mutex);
+			stats->rejected++;
+			return -ESHUTDOWN;
+		}
+
+		if (!atomic_read(&data->urgent))
+			return 0;
+
+		/* an urgent section started meanwhile, it goes first */
+		mutex_unlock(&data->xfer_mutex);
+	}
+}
+
+static inline void rmi_xfer_unlock(struct rmi_data *data)
+{
+	mutex_unlock(&data->xfer_mutex);
+}
+
+/*
+ * A reset brings the page select register back to 0. The page is only
+ * trusted by the owner of the bus, so it is updated with the bus held.
+ */
+static int rmi_xfer_page_reset(struct rmi_data *data)
+{
+	int ret;
+
+	ret = rmi_xfer_lock(data);
+	if (ret)
+		return ret;
+
+	mutex_lock(&data->page_mutex);
+	data->page = 0;
+	mutex_unlock(&data->page_mutex);
 
-static int rmi_write_report(struct hid_device *hdev, u8 *report, int len);
+	rmi_xfer_unlock(data);
+	return 0;
+}
+
+/*
+ * Must not wait for anything doing normal transactions (works), those
+ * would wait for the urgent section in turn.
+ */
+static void rmi_urgent_begin(struct rmi_data *data)
+{
+	atomic_inc(&data->urgent);
+
+	if (mutex_is_locked(&data->xfer_mutex)) {
+		WRITE_ONCE(data->xfer_abort, true);
+		wake_up(&data->wait);
+		data->xfer_stats.preemptions++;
+	}
+
+	mutex_lock(&data->urgent_mutex);
+	WRITE_ONCE(data->urgent_task, current);
+}
+
+/*
+ * The abort is over with the last urgent section, even when none of them
+ * took the bus (a mode switch, a device which is not open): normal
+ * transactions go through again.
+ */
+static void rmi_urgent_end(struct rmi_data *data)
+{
+	WRITE_ONCE(data->urgent_task, NULL);
+	mutex_unlock(&data->urgent_mutex);
+
+	if (atomic_dec_and_test(&data->urgent)) {
+		WRITE_ONCE(data->xfer_abort, false);
+		wake_up_all(&data->xfer_wait);
+	}
+}
 
 /**
  * rmi_set_page - Set RMI page
- * @hdev: The pointer to the hid_device struct
+ * @data: The pointer to the rmi_data struct
  * @page: The new page address.
  *
  * RMI devices have 16-bit addressing, but some of the physical
@@ -137,716 +1077,5231 @@ static int rmi_write_report(struct hid_device *hdev, u8 *report, int len);
  * a page address at 0xff of every page so we can reliable page addresses
  * every 256 registers.
  *
- * The page_mutex lock must be held when this function is entered.
+ * The xfer_mutex lock must be held when this function is entered.
  *
  * Returns zero on success, non-zero on failure.
  */
-static int rmi_set_page(struct hid_device *hdev, u8 page)
+static int rmi_set_page(struct rmi_data *data, u8 page)
 {
-	struct rmi_data *data = hid_get_drvdata(hdev);
+	u64 start = ktime_get_ns();
 	int retval;
 
-	data->writeReport[0] = RMI_WRITE_REPORT_ID;
-	data->writeReport[1] = 1;
-	data->writeReport[2] = 0xFF;
-	data->writeReport[4] = page;
-
-	retval = rmi_write_report(hdev, data->writeReport,
-			data->output_report_size);
-	if (retval != data->output_report_size) {
-		dev_err(&hdev->dev,
+	retval = data->xport->write_block(data, RMI_PAGE_SELECT_REGISTER,
+			&page, 1);
+	rmi_trace(data, RMI_TRACE_PAGE, 0,
+		  (page << 8) | RMI_PAGE_SELECT_REGISTER, 1, retval, start);
+	if (retval) {
+		dev_err(data->dev,
 			"%s: set page failed: %d.", __func__, retval);
 		return retval;
 	}
 
+	mutex_lock(&data->page_mutex);
 	data->page = page;
+	mutex_unlock(&data->page_mutex);
+	data->xfer_stats.page_switches++;
 	return 0;
 }
 
-static int rmi_set_mode(struct hid_device *hdev, u8 mode)
+static int rmi_set_mode(struct rmi_data *data, u8 mode)
 {
-	int ret;
-	u8 txbuf[2] = {RMI_SET_RMI_MODE_REPORT_ID, mode};
-
-	ret = hid_hw_raw_request(hdev, RMI_SET_RMI_MODE_REPORT_ID, txbuf,
-			sizeof(txbuf), HID_FEATURE_REPORT, HID_REQ_SET_REPORT);
-	if (ret < 0) {
-		dev_err(&hdev->dev, "unable to set rmi mode to %d (%d)\n", mode,
-			ret);
-		return ret;
-	}
+	if (!data->xport->set_mode)
+		return 0;
 
-	return 0;
+	return data->xport->set_mode(data, mode);
 }
 
-static int rmi_write_report(struct hid_device *hdev, u8 * report, int len)
+static int rmi_read_block(struct rmi_data *data, u16 addr, void *buf,
+		const int len)
 {
+	u64 start;
 	int ret;
 
-	ret = hid_hw_output_report(hdev, (void *)report, len);
-	if (ret < 0) {
-		dev_err(&hdev->dev, "failed to write hid report (%d)\n", ret);
+	ret = rmi_xfer_lock(data);
+	if (ret)
 		return ret;
+
+	start = ktime_get_ns();
+
+	if (RMI_PAGE(addr) != READ_ONCE(data->page)) {
+		ret = rmi_set_page(data, RMI_PAGE(addr));
+		if (ret < 0)
+			goto exit;
 	}
 
+	ret = data->xport->read_block(data, addr, buf, len);
+
+exit:
+	rmi_trace(data, RMI_TRACE_READ, 0, addr, len, ret, start);
+	data->xfer_stats.reads++;
+	data->xfer_stats.read_ns += ktime_get_ns() - start;
+	if (ret)
+		data->xfer_stats.errors++;
+	else
+		data->xfer_stats.read_bytes += len;
+	rmi_xfer_unlock(data);
 	return ret;
 }
 
-static int rmi_read_block(struct hid_device *hdev, u16 addr, void *buf,
-		const int len)
+static inline int rmi_read(struct rmi_data *data, u16 addr, void *buf)
 {
-	struct rmi_data *data = hid_get_drvdata(hdev);
-	int ret;
-	int bytes_read;
-	int bytes_needed;
-	int retries;
-	int read_input_count;
+	return rmi_read_block(data, addr, buf, 1);
+}
+
+/*
+ * Keep the control register cache in sync with what was written to the
+ * device, so that it can be restored after a reset without rediscovering.
+ * The registers written are flagged, only those are restored.
+ */
+static void rmi_ctrl_cache_update(struct rmi_data *data, u16 addr,
+		const u8 *buf, int len)
+{
+	struct rmi_function *fns[] = { &data->f01, &data->f11, &data->f30 };
+	struct rmi_function *f;
+	int start, end;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fns); i++) {
+		f = fns[i];
+		if (!f->ctrl_size)
+			continue;
+
+		start = max_t(int, addr, f->control_base_addr);
+		end = min_t(int, addr + len,
+			    f->control_base_addr + f->ctrl_size);
+		if (start < end) {
+			memcpy(&f->ctrl[start - f->control_base_addr],
+			       &buf[start - addr], end - start);
+			bitmap_set(f->ctrl_dirty, start - f->control_base_addr,
+				   end - start);
+		}
+	}
+}
+
+static int rmi_write_block(struct rmi_data *data, u16 addr, const void *buf,
+		const int len)
+{
+	int ret = 0;
+	int offset;
+	int chunk;
+	u64 start;
+
+	ret = rmi_xfer_lock(data);
+	if (ret)
+		return ret;
+
+	start = ktime_get_ns();
+
+	if (RMI_PAGE(addr) != READ_ONCE(data->page)) {
+		ret = rmi_set_page(data, RMI_PAGE(addr));
+		if (ret < 0)
+			goto exit;
+	}
+
+	for (offset = 0; offset < len; offset += chunk) {
+		chunk = min(len - offset, data->max_write_size);
+		ret = data->xport->write_block(data, addr + offset,
+				buf + offset, chunk);
+		if (ret)
+			break;
+		data->xfer_stats.writes++;
+		data->xfer_stats.write_bytes += chunk;
+	}
+
+exit:
+	rmi_trace(data, RMI_TRACE_WRITE, 0, addr, len, ret, start);
+	data->xfer_stats.write_ns += ktime_get_ns() - start;
+	if (ret) {
+		data->xfer_stats.errors++;
+	} else {
+		mutex_lock(&data->page_mutex);
+		rmi_ctrl_cache_update(data, addr, buf, len);
+		mutex_unlock(&data->page_mutex);
+	}
+	rmi_xfer_unlock(data);
+	return ret;
+}
+
+static inline int rmi_write(struct rmi_data *data, u16 addr, u8 value)
+{
+	return rmi_write_block(data, addr, &value, 1);
+}
+
+static inline int rmi_transport_get(struct rmi_data *data)
+{
+	if (!data->xport->open)
+		return 0;
+
+	return data->xport->open(data);
+}
+
+static inline void rmi_transport_put(struct rmi_data *data)
+{
+	if (data->xport->close)
+		data->xport->close(data);
+}
+
+static int rmi_f01_set_sleep(struct rmi_data *data, u8 sleep_mode)
+{
+	u8 ctrl0;
+	int ret;
+
+	if (!data->f01.query_base_addr)
+		return 0;
+
+	ctrl0 = (data->f01.ctrl[0] & ~RMI_F01_CTRL0_SLEEP_MASK) | sleep_mode;
+	ret = rmi_write(data, data->f01.control_base_addr, ctrl0);
+	if (ret) {
+		if (ret != -ESHUTDOWN)
+			dev_err(data->dev, "can not set sleep mode %d: %d\n",
+				sleep_mode, ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Write back the control registers the driver changed since discovery, one
+ * block write per run of them. The others keep the firmware defaults the
+ * device came back with.
+ */
+static int rmi_restore_ctrl(struct rmi_data *data)
+{
+	struct rmi_function *fns[] = { &data->f01, &data->f11, &data->f30 };
+	DECLARE_BITMAP(dirty, RMI_CTRL_CACHE_SIZE);
+	struct rmi_function *f;
+	u8 buf[RMI_CTRL_CACHE_SIZE];
+	unsigned int first, end;
+	int ret;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fns); i++) {
+		f = fns[i];
+		if (!f->ctrl_size)
+			continue;
+
+		mutex_lock(&data->page_mutex);
+		memcpy(buf, f->ctrl, f->ctrl_size);
+		bitmap_copy(dirty, f->ctrl_dirty, RMI_CTRL_CACHE_SIZE);
+		mutex_unlock(&data->page_mutex);
+
+		for (first = find_first_bit(dirty, f->ctrl_size);
+		     first < f->ctrl_size;
+		     first = find_next_bit(dirty, f->ctrl_size, end)) {
+			end = find_next_zero_bit(dirty, f->ctrl_size, first);
+
+			ret = rmi_write_block(data, f->control_base_addr + first,
+					&buf[first], end - first);
+			if (ret) {
+				dev_err(data->dev,
+					"can not restore ctrl at %#06x: %d\n",
+					f->control_base_addr + first, ret);
+				return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Control register profile: a snapshot of every cached control block,
+ * tagged with the function and the address it belongs to. Writing one back
+ * only touches the registers that differ from the cache.
+ */
+#define RMI_PROFILE_MAGIC		0x504d4952	/* "RMIP" */
+#define RMI_PROFILE_VERSION		2
+
+struct rmi_profile_header {
+	__le32 magic;
+	u8 version;
+	u8 nr_blocks;
+	__le16 reserved;
+} __packed;
+
+struct rmi_profile_block {
+	u8 function;
+	u8 size;
+	__le16 addr;
+	u8 ctrl[];
+} __packed;
+
+#define RMI_PROFILE_FUNCTIONS		3
+#define RMI_PROFILE_MAX_SIZE		(sizeof(struct rmi_profile_header) + \
+		RMI_PROFILE_FUNCTIONS * \
+		(sizeof(struct rmi_profile_block) + RMI_CTRL_CACHE_SIZE))
+
+static const u8 rmi_profile_numbers[RMI_PROFILE_FUNCTIONS] = {
+	0x01, 0x11, 0x30
+};
+
+/* @buf must hold RMI_PROFILE_MAX_SIZE bytes, returns the blob length */
+static int rmi_profile_export(struct rmi_data *data, u8 *buf)
+{
+	struct rmi_function *fns[] = { &data->f01, &data->f11, &data->f30 };
+	struct rmi_profile_header *hdr = (void *)buf;
+	struct rmi_profile_block *blk;
+	struct rmi_function *f;
+	int len = sizeof(*hdr);
+	int i;
+
+	hdr->magic = cpu_to_le32(RMI_PROFILE_MAGIC);
+	hdr->version = RMI_PROFILE_VERSION;
+	hdr->nr_blocks = 0;
+	hdr->reserved = 0;
+
+	mutex_lock(&data->page_mutex);
+	for (i = 0; i < ARRAY_SIZE(fns); i++) {
+		f = fns[i];
+		if (!f->ctrl_size)
+			continue;
+
+		blk = (void *)&buf[len];
+		blk->function = rmi_profile_numbers[i];
+		blk->size = f->ctrl_size;
+		blk->addr = cpu_to_le16(f->control_base_addr);
+		memcpy(blk->ctrl, f->ctrl, f->ctrl_size);
+		len += sizeof(*blk) + f->ctrl_size;
+		hdr->nr_blocks++;
+	}
+	mutex_unlock(&data->page_mutex);
+
+	return len;
+}
+
+/*
+ * The whole blob is checked against the functions found in the PDT before
+ * anything is written. Each function then gets one block write per run of
+ * changed registers: a register the profile leaves as it is never written,
+ * like in rmi_restore_ctrl().
+ */
+static int rmi_profile_apply(struct rmi_data *data, const u8 *buf, size_t len)
+{
+	struct rmi_function *fns[] = { &data->f01, &data->f11, &data->f30 };
+	const struct rmi_profile_header *hdr = (const void *)buf;
+	const struct rmi_profile_block *blks[RMI_PROFILE_FUNCTIONS] = { };
+	const struct rmi_profile_block *blk;
+	DECLARE_BITMAP(changed, RMI_CTRL_CACHE_SIZE);
+	u8 ctrl[RMI_CTRL_CACHE_SIZE];
+	struct rmi_function *f;
+	size_t offset = sizeof(*hdr);
+	unsigned int first, end;
+	int writes = 0;
+	int ret;
+	int i, n;
+
+	if (len < sizeof(*hdr) || le32_to_cpu(hdr->magic) != RMI_PROFILE_MAGIC)
+		return -EINVAL;
+
+	if (hdr->version != RMI_PROFILE_VERSION) {
+		dev_err(data->dev, "unsupported profile version %d\n",
+			hdr->version);
+		return -EINVAL;
+	}
+
+	for (n = 0; n < hdr->nr_blocks; n++) {
+		if (offset + sizeof(*blk) > len)
+			return -EINVAL;
+
+		blk = (const void *)&buf[offset];
+		offset += sizeof(*blk) + blk->size;
+		if (offset > len)
+			return -EINVAL;
+
+		for (i = 0; i < ARRAY_SIZE(fns); i++)
+			if (blk->function == rmi_profile_numbers[i])
+				break;
+
+		if (i == ARRAY_SIZE(fns) || blks[i] || !fns[i]->ctrl_size ||
+		    fns[i]->ctrl_size != blk->size ||
+		    fns[i]->control_base_addr != le16_to_cpu(blk->addr)) {
+			dev_err(data->dev,
+				"profile block F%02x at %#06x does not match the device\n",
+				blk->function, le16_to_cpu(blk->addr));
+			return -ENODEV;
+		}
+
+		blks[i] = blk;
+	}
+
+	if (offset != len)
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(fns); i++) {
+		f = fns[i];
+		blk = blks[i];
+		if (!blk)
+			continue;
+
+		memcpy(ctrl, blk->ctrl, blk->size);
+
+		mutex_lock(&data->page_mutex);
+		/* the sleep mode follows the input device, not the profile */
+		if (f == &data->f01) {
+			ctrl[0] &= ~RMI_F01_CTRL0_SLEEP_MASK;
+			ctrl[0] |= f->ctrl[0] & RMI_F01_CTRL0_SLEEP_MASK;
+		}
+
+		bitmap_zero(changed, RMI_CTRL_CACHE_SIZE);
+		for (first = 0; first < blk->size; first++)
+			if (ctrl[first] != f->ctrl[first])
+				set_bit(first, changed);
+		mutex_unlock(&data->page_mutex);
+
+		for (first = find_first_bit(changed, blk->size);
+		     first < blk->size;
+		     first = find_next_bit(changed, blk->size, end)) {
+			end = find_next_zero_bit(changed, blk->size, first);
+
+			ret = rmi_write_block(data, f->control_base_addr + first,
+					&ctrl[first], end - first);
+			if (ret) {
+				dev_err(data->dev,
+					"can not apply profile to F%02x: %d\n",
+					blk->function, ret);
+				return ret;
+			}
+			writes++;
+		}
+	}
+
+	dev_dbg(data->dev, "profile applied in %d writes\n", writes);
+
+	return 0;
+}
+
+/*
+ * Wake-on-touch: leave the sensor reporting, but allow it to doze between
+ * touches, so that the first attention report can wake the system.
+ */
+static int rmi_f01_arm_wake(struct rmi_data *data)
+{
+	u8 ctrl0;
+	int ret;
+
+	if (!data->f01.query_base_addr)
+		return -ENODEV;
+
+	data->wake_ctrl0 = data->f01.ctrl[0];
+	ctrl0 = data->wake_ctrl0 & ~(RMI_F01_CTRL0_SLEEP_MASK |
+				     RMI_F01_CTRL0_NOSLEEP);
+	ret = rmi_write(data, data->f01.control_base_addr, ctrl0);
+	if (ret)
+		return ret;
+
+	data->pm_stats.wake_suspend_ns = ktime_get_boottime_ns();
+	data->pm_stats.wake_resume_ns = 0;
+	set_bit(RMI_WAKE_PENDING, &data->flags);
+	set_bit(RMI_WAKE_ARMED, &data->flags);
+
+	return 0;
+}
+
+/*
+ * Called for every attention frame while a wake-on-touch is pending: the
+ * first one is the wake event.
+ */
+static void rmi_wake_frame(struct rmi_data *data)
+{
+	u64 now = ktime_get_boottime_ns();
+	u64 resumed = data->pm_stats.wake_resume_ns;
+
+	if (!test_and_clear_bit(RMI_WAKE_PENDING, &data->flags))
+		return;
+
+	if (resumed && now - resumed > RMI_WAKE_WINDOW_NS)
+		return;
+
+	data->pm_stats.wake_frames++;
+	data->pm_stats.wake_frame_ns = now;
+	if (data->wake_dev)
+		pm_wakeup_event(data->wake_dev, 0);
+}
+
+/*
+ * Adaptive report rate: while the contacts are still (or absent) the
+ * sensor is in reduced reporting mode and only reports motion larger than
+ * RMI_RATE_SLOW_DELTA_MM. The first frame with moving contacts switches
+ * back to the parameters of the firmware right away, the rate is lowered
+ * again only after idle_delay_ms without motion, so that short pauses do
+ * not thrash. The reporting mode (control 0) and the delta thresholds
+ * (control 2 and 3) are written as one block with control 1 unchanged, a
+ * single transaction per switch.
+ */
+static int rmi_rate_apply(struct rmi_data *data, enum rmi_rate_mode mode)
+{
+	struct rmi_rate *rate = &data->rate;
+	u64 start = ktime_get_ns();
+	u64 xfers = data->xfer_stats.writes + data->xfer_stats.page_switches;
+	u8 ctrl[RMI_F11_CTRL_DELTA_Y + 1];
+	u64 elapsed;
+	int ret;
 
 	mutex_lock(&data->page_mutex);
+	memcpy(ctrl, data->f11.ctrl, sizeof(ctrl));
+	mutex_unlock(&data->page_mutex);
+
+	ctrl[RMI_F11_CTRL_REPORT_MODE] &= ~RMI_F11_CTRL0_REPORT_MODE_MASK;
+	ctrl[RMI_F11_CTRL_REPORT_MODE] |= rate->report_mode[mode];
+	ctrl[RMI_F11_CTRL_DELTA_X] = rate->delta[mode][0];
+	ctrl[RMI_F11_CTRL_DELTA_Y] = rate->delta[mode][1];
+
+	ret = rmi_write_block(data, data->f11.control_base_addr, ctrl,
+			      sizeof(ctrl));
+	if (ret)
+		goto err;
+
+	elapsed = ktime_get_ns() - start;
+	/* other traffic may run meanwhile, the count is an upper bound */
+	xfers = data->xfer_stats.writes + data->xfer_stats.page_switches -
+		xfers;
+	rate->stats.switch_xfers += xfers;
+	rate->stats.switch_xfers_last = xfers;
+	rate->stats.mode_ns[rate->mode] += start - rate->since_ns;
+	rate->stats.switches++;
+	rate->stats.switch_last_ns = elapsed;
+	if (elapsed > rate->stats.switch_max_ns)
+		rate->stats.switch_max_ns = elapsed;
+
+	rate->mode = mode;
+	rate->since_ns = start;
+	return 0;
+
+err:
+	rate->stats.errors++;
+	dev_err(data->dev, "can not switch the report rate: %d\n", ret);
+	return ret;
+}
+
+static void rmi_rate_work(struct work_struct *work)
+{
+	struct rmi_data *data = container_of(to_delayed_work(work),
+					     struct rmi_data, rate.work);
+	struct rmi_rate *rate = &data->rate;
+	unsigned long idle_at = READ_ONCE(rate->last_motion) +
+				msecs_to_jiffies(idle_delay_ms);
+	u64 onset;
+
+	if (rate->mode == RMI_RATE_FAST) {
+		if (time_before(jiffies, idle_at)) {
+			queue_delayed_work(rmi_wq, &rate->work,
+					   idle_at - jiffies);
+			return;
+		}
+
+		rmi_rate_apply(data, RMI_RATE_SLOW);
+		return;
+	}
+
+	onset = READ_ONCE(rate->onset_ns);
+	if (!onset)
+		return;
+
+	if (rmi_rate_apply(data, RMI_RATE_FAST))
+		return;
+
+	/* latency added by the lowered rate at motion onset */
+	rate->stats.onset_last_ns = ktime_get_ns() - onset;
+	if (rate->stats.onset_last_ns > rate->stats.onset_max_ns)
+		rate->stats.onset_max_ns = rate->stats.onset_last_ns;
+	WRITE_ONCE(rate->onset_ns, 0);
+
+	queue_delayed_work(rmi_wq, &rate->work,
+			   msecs_to_jiffies(idle_delay_ms));
+}
+
+/* called from the attention path for every F11 frame */
+static void rmi_rate_frame(struct rmi_data *data, bool moved)
+{
+	struct rmi_rate *rate = &data->rate;
+
+	rate->stats.frames[rate->mode]++;
+
+	if (!moved || !test_bit(RMI_OPENED, &data->flags))
+		return;
+
+	WRITE_ONCE(rate->last_motion, jiffies);
+
+	if (rate->mode == RMI_RATE_SLOW) {
+		if (!READ_ONCE(rate->onset_ns))
+			WRITE_ONCE(rate->onset_ns, ktime_get_ns());
+		mod_delayed_work(rmi_wq, &rate->work, 0);
+	} else {
+		/* a no-op while the idle check is pending */
+		queue_delayed_work(rmi_wq, &rate->work,
+				   msecs_to_jiffies(idle_delay_ms));
+	}
+}
+
+static void rmi_rate_start(struct rmi_data *data)
+{
+	if (!data->rate.enabled)
+		return;
+
+	WRITE_ONCE(data->rate.last_motion, jiffies);
+	queue_delayed_work(rmi_wq, &data->rate.work,
+			   msecs_to_jiffies(idle_delay_ms));
+}
+
+static void rmi_rate_stop(struct rmi_data *data)
+{
+	if (!data->rate.enabled)
+		return;
+
+	cancel_delayed_work_sync(&data->rate.work);
+	WRITE_ONCE(data->rate.onset_ns, 0);
+}
+
+/* time spent in each mode of the polling fallback, see rmi_poll_once() */
+static void rmi_poll_account(struct rmi_poll *poll, u64 now)
+{
+	if (!poll->since_ns)
+		return;
+
+	if (poll->active)
+		poll->stats.poll_ns += now - poll->since_ns;
+	else
+		poll->stats.attn_ns += now - poll->since_ns;
+	poll->since_ns = now;
+}
+
+static void rmi_poll_leave(struct rmi_data *data)
+{
+	struct rmi_poll *poll = &data->poll;
+
+	rmi_poll_account(poll, ktime_get_ns());
+	WRITE_ONCE(poll->active, false);
+}
+
+/* called for every attention frame received from the device */
+static void rmi_poll_attention(struct rmi_data *data)
+{
+	struct rmi_poll *poll = &data->poll;
+
+	WRITE_ONCE(poll->stats.attn_frames, poll->stats.attn_frames + 1);
+
+	/* the attention line is back */
+	if (poll_mode == RMI_POLL_AUTO && READ_ONCE(poll->active)) {
+		poll->stats.to_attn++;
+		rmi_poll_leave(data);
+	}
+}
+
+static void rmi_poll_arm(struct rmi_data *data);
+static void rmi_poll_halt(struct rmi_data *data);
+
+/* the background activity of an open device, which touches registers */
+static void rmi_workers_start(struct rmi_data *data)
+{
+	rmi_rate_start(data);
+	rmi_poll_arm(data);
+}
+
+static void rmi_workers_stop(struct rmi_data *data)
+{
+	rmi_poll_halt(data);
+	rmi_rate_stop(data);
+}
+
+enum rmi_suspend_type {
+	RMI_SUSPEND_SLEEP,	/* system sleep, the sensor sleeps as well */
+	RMI_SUSPEND_WAKE,	/* system sleep, a touch wakes the system */
+	RMI_SUSPEND_IDLE,	/* runtime suspend, the sensor is left as is */
+};
+
+/*
+ * System suspend: the sensor goes to sleep with a single F01 control
+ * write. It is already asleep if nobody has the input device open. With
+ * RMI_SUSPEND_WAKE it keeps reporting in a low power state instead, and
+ * the first frame after resume is accounted as the wake event.
+ */
+static int rmi_suspend(struct rmi_data *data, enum rmi_suspend_type type)
+{
+	u64 start = ktime_get_ns();
+	int ret = 0;
+
+	/*
+	 * The urgent section aborts the transaction in flight first, so that
+	 * stopping the works does not wait for a stalled read. Quiesced, the
+	 * works cannot start new transactions and finish right away.
+	 */
+	rmi_xfer_set_state(data, RMI_XFER_QUIESCED);
+	rmi_urgent_begin(data);
+	rmi_workers_stop(data);
+
+	if (test_bit(RMI_OPENED, &data->flags)) {
+		if (type == RMI_SUSPEND_WAKE)
+			ret = rmi_f01_arm_wake(data);
+		else if (type == RMI_SUSPEND_SLEEP)
+			ret = rmi_f01_set_sleep(data,
+					RMI_F01_CTRL0_SLEEP_SENSOR);
+	}
+	rmi_urgent_end(data);
+
+	/* the PM core does not call resume after a failed suspend */
+	if (ret)
+		rmi_xfer_set_state(data, RMI_XFER_RUNNING);
+
+	data->pm_stats.suspends++;
+	data->pm_stats.suspend_last_ns = ktime_get_ns() - start;
+	dev_dbg(data->dev, "suspended in %llu us\n",
+		div_u64(data->pm_stats.suspend_last_ns, NSEC_PER_USEC));
+
+	return ret;
+}
+
+/*
+ * System resume: restore the reporting mode and wake the sensor if it is
+ * in use. After a reset the device lost its whole configuration, so the
+ * control registers the driver changed are written back from the cache
+ * instead of rediscovering it.
+ */
+static int rmi_resume(struct rmi_data *data, bool reset)
+{
+	u8 sleep_mode = test_bit(RMI_OPENED, &data->flags) ?
+			RMI_F01_CTRL0_SLEEP_NORMAL : RMI_F01_CTRL0_SLEEP_SENSOR;
+	u64 start = ktime_get_ns();
+	u64 elapsed;
+	bool armed;
+	int ret;
+
+	rmi_xfer_set_state(data, RMI_XFER_RUNNING);
+	rmi_urgent_begin(data);
+
+	armed = test_and_clear_bit(RMI_WAKE_ARMED, &data->flags);
+	if (armed) {
+		data->pm_stats.wake_resume_ns = ktime_get_boottime_ns();
+		mutex_lock(&data->page_mutex);
+		data->f01.ctrl[0] = data->wake_ctrl0;
+		mutex_unlock(&data->page_mutex);
+	}
+
+	ret = rmi_set_mode(data, RMI_MODE_ATTN_REPORTS);
+	if (ret) {
+		rmi_urgent_end(data);
+		return ret;
+	}
+
+	if (reset) {
+		ret = rmi_xfer_page_reset(data);
+		if (ret) {
+			rmi_urgent_end(data);
+			return ret;
+		}
+
+		mutex_lock(&data->page_mutex);
+		data->f01.ctrl[0] &= ~RMI_F01_CTRL0_SLEEP_MASK;
+		data->f01.ctrl[0] |= sleep_mode;
+		set_bit(0, data->f01.ctrl_dirty);
+		mutex_unlock(&data->page_mutex);
+
+		ret = rmi_restore_ctrl(data);
+	} else if (armed) {
+		ret = rmi_write(data, data->f01.control_base_addr,
+				data->wake_ctrl0);
+	} else if (sleep_mode == RMI_F01_CTRL0_SLEEP_NORMAL) {
+		ret = rmi_f01_set_sleep(data, sleep_mode);
+	}
+
+	rmi_urgent_end(data);
+
+	if (!ret && test_bit(RMI_OPENED, &data->flags))
+		rmi_workers_start(data);
+
+	elapsed = ktime_get_ns() - start;
+	data->pm_stats.resumes++;
+	data->pm_stats.resume_last_ns = elapsed;
+	if (elapsed > data->pm_stats.resume_max_ns)
+		data->pm_stats.resume_max_ns = elapsed;
+	dev_dbg(data->dev, "%sresumed in %llu us\n", reset ? "reset " : "",
+		div_u64(elapsed, NSEC_PER_USEC));
+
+	return ret;
+}
+
+/*
+ * HID transport: registers are tunnelled through output reports, and the
+ * replies come back as RMI_READ_DATA_REPORT_ID input reports.
+ *
+ * Every report goes through a transaction of the pool, so that nothing is
+ * allocated on the resume, reset or attention paths and the low level
+ * driver never gets a buffer on the stack to DMA from. The pool is sized
+ * for the bus holder plus the mode switches and resets that may run beside
+ * it; a task only sleeps on it when they all overlap.
+ */
+
+static int rmi_xfer_pool_init(struct rmi_data *data)
+{
+	struct rmi_xfer_pool *pool = &data->pool;
+	size_t out = ALIGN(data->output_report_size, ARCH_DMA_MINALIGN);
+	size_t in = ALIGN(data->input_report_size, ARCH_DMA_MINALIGN);
+	u8 *buf;
+	int i;
+
+	buf = devm_kcalloc(data->dev, RMI_XFER_POOL_SIZE, out + in,
+			   GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	for (i = 0; i < RMI_XFER_POOL_SIZE; i++) {
+		pool->xfers[i].out = buf;
+		pool->xfers[i].in = buf + out;
+		buf += out + in;
+	}
+
+	init_waitqueue_head(&pool->wait);
+	pool->free = GENMASK(RMI_XFER_POOL_SIZE - 1, 0);
+	return 0;
+}
+
+static struct rmi_xfer *rmi_xfer_tryget(struct rmi_xfer_pool *pool)
+{
+	unsigned long free;
+	int i;
+
+	while ((free = READ_ONCE(pool->free))) {
+		i = __ffs(free);
+		if (test_and_clear_bit(i, &pool->free))
+			return &pool->xfers[i];
+	}
+
+	return NULL;
+}
+
+static struct rmi_xfer *rmi_xfer_get(struct rmi_data *data)
+{
+	struct rmi_xfer_pool *pool = &data->pool;
+	struct rmi_xfer *xfer = rmi_xfer_tryget(pool);
+
+	if (!xfer) {
+		pool->waits++;
+		wait_event(pool->wait, (xfer = rmi_xfer_tryget(pool)));
+	}
+
+	return xfer;
+}
+
+static void rmi_xfer_put(struct rmi_data *data, struct rmi_xfer *xfer)
+{
+	struct rmi_xfer_pool *pool = &data->pool;
+
+	set_bit(xfer - pool->xfers, &pool->free);
+	if (wq_has_sleeper(&pool->wait))
+		wake_up(&pool->wait);
+}
+
+static int rmi_hid_set_mode(struct rmi_data *data, u8 mode)
+{
+	struct hid_device *hdev = data->hdev;
+	struct rmi_xfer *xfer = rmi_xfer_get(data);
+	int ret;
+	u64 start = ktime_get_ns();
+
+	xfer->out[0] = RMI_SET_RMI_MODE_REPORT_ID;
+	xfer->out[1] = mode;
+
+	ret = hid_hw_raw_request(hdev, RMI_SET_RMI_MODE_REPORT_ID, xfer->out,
+			2, HID_FEATURE_REPORT, HID_REQ_SET_REPORT);
+	rmi_xfer_put(data, xfer);
+	rmi_trace(data, RMI_TRACE_OUT, RMI_SET_RMI_MODE_REPORT_ID, 0,
+		  2, ret, start);
+	if (ret < 0) {
+		dev_err(&hdev->dev, "unable to set rmi mode to %d (%d)\n", mode,
+			ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+static int rmi_write_report(struct hid_device *hdev, u8 * report, int len)
+{
+	u64 start = ktime_get_ns();
+	int ret;
+
+	ret = hid_hw_output_report(hdev, (void *)report, len);
+	/* both RMI output reports carry the address in bytes 2 and 3 */
+	rmi_trace(hid_get_drvdata(hdev), RMI_TRACE_OUT, report[0],
+		  report[2] | (report[3] << 8), len, ret, start);
+	if (ret < 0) {
+		dev_err(&hdev->dev, "failed to write hid report (%d)\n", ret);
+		return ret;
+	}
+
+	return ret;
+}
+
+#define RMI_READ_RETRIES		5
+
+/* a read data report was lost or cut short, and a retry got it back */
+static void rmi_read_recovered(struct rmi_data *data, int retries,
+		u64 elapsed)
+{
+	struct rmi_recovery_stats *stats = &data->recovery_stats;
+
+	stats->read_retries += retries;
+	stats->read_recoveries++;
+	stats->read_recover_ns += elapsed;
+	if (elapsed > stats->read_recover_max_ns)
+		stats->read_recover_max_ns = elapsed;
+}
+
+static int rmi_hid_read_block(struct rmi_data *data, u16 addr, void *buf,
+		const int len)
+{
+	struct hid_device *hdev = data->hdev;
+	int ret;
+	int bytes_read;
+	int bytes_needed;
+	int retries;
+	int read_input_count;
+	u64 start = ktime_get_ns();
+	struct rmi_xfer *xfer = rmi_xfer_get(data);
+
+	WRITE_ONCE(data->xfer_read, xfer);
+
+	for (retries = RMI_READ_RETRIES; retries > 0; retries--) {
+		if (rmi_xfer_aborted(data)) {
+			ret = -ECANCELED;
+			goto exit;
+		}
+
+		xfer->out[0] = RMI_READ_ADDR_REPORT_ID;
+		xfer->out[1] = 0; /* old 1 byte read count */
+		xfer->out[2] = addr & 0xFF;
+		xfer->out[3] = (addr >> 8) & 0xFF;
+		xfer->out[4] = len  & 0xFF;
+		xfer->out[5] = (len >> 8) & 0xFF;
+
+		set_bit(RMI_READ_REQUEST_PENDING, &data->flags);
+
+		ret = rmi_write_report(hdev, xfer->out,
+						data->output_report_size);
+		if (ret != data->output_report_size) {
+			clear_bit(RMI_READ_REQUEST_PENDING, &data->flags);
+			dev_err(&hdev->dev,
+				"failed to write request output report (%d)\n",
+				ret);
+			if (ret >= 0)
+				ret = -EIO;
+			goto exit;
+		}
+
+		bytes_read = 0;
+		bytes_needed = len;
+		while (bytes_read < len) {
+			ret = wait_event_timeout(data->wait,
+				test_bit(RMI_READ_DATA_PENDING, &data->flags) ||
+				rmi_xfer_aborted(data),
+					msecs_to_jiffies(1000));
+			if (!test_bit(RMI_READ_DATA_PENDING, &data->flags) &&
+			    rmi_xfer_aborted(data)) {
+				data->xfer_stats.aborts++;
+				ret = -ECANCELED;
+				goto exit;
+			}
+			if (!ret) {
+				hid_warn(hdev, "%s: timeout elapsed\n",
+					 __func__);
+				rmi_trace(data, RMI_TRACE_TIMEOUT,
+					  RMI_READ_DATA_REPORT_ID, addr, len,
+					  -EAGAIN, ktime_get_ns());
+				ret = -EAGAIN;
+				break;
+			}
+
+			read_input_count = xfer->in[1];
+			memcpy(buf + bytes_read, &xfer->in[2],
+				read_input_count < bytes_needed ?
+					read_input_count : bytes_needed);
+
+			bytes_read += read_input_count;
+			bytes_needed -= read_input_count;
+			clear_bit(RMI_READ_DATA_PENDING, &data->flags);
+		}
+
+		if (ret >= 0) {
+			ret = 0;
+			break;
+		}
+	}
+
+	if (!ret && retries < RMI_READ_RETRIES)
+		rmi_read_recovered(data, RMI_READ_RETRIES - retries,
+				   ktime_get_ns() - start);
+	else if (ret == -EAGAIN)
+		data->recovery_stats.read_failures++;
+
+exit:
+	clear_bit(RMI_READ_REQUEST_PENDING, &data->flags);
+	WRITE_ONCE(data->xfer_read, NULL);
+	rmi_xfer_put(data, xfer);
+	return ret;
+}
+
+static int rmi_hid_write_block(struct rmi_data *data, u16 addr,
+		const void *buf, const int len)
+{
+	struct hid_device *hdev = data->hdev;
+	struct rmi_xfer *xfer = rmi_xfer_get(data);
+	int ret;
+
+	xfer->out[0] = RMI_WRITE_REPORT_ID;
+	xfer->out[1] = len;
+	xfer->out[2] = addr & 0xFF;
+	xfer->out[3] = (addr >> 8) & 0xFF;
+	memcpy(&xfer->out[4], buf, len);
+
+	ret = rmi_write_report(hdev, xfer->out, data->output_report_size);
+	rmi_xfer_put(data, xfer);
+	if (ret != data->output_report_size) {
+		dev_err(&hdev->dev,
+			"failed to write request output report (%d)\n", ret);
+		return ret < 0 ? ret : -EIO;
+	}
+
+	return 0;
+}
+
+static int rmi_hid_open(struct rmi_data *data)
+{
+	/* starts the input pipe, and resumes the device if autosuspended */
+	return hid_hw_open(data->hdev);
+}
+
+static void rmi_hid_close(struct rmi_data *data)
+{
+	hid_hw_close(data->hdev);
+}
+
+static const struct rmi_transport_ops rmi_hid_ops = {
+	.name		= "hid",
+	.read_block	= rmi_hid_read_block,
+	.write_block	= rmi_hid_write_block,
+	.set_mode	= rmi_hid_set_mode,
+	.open		= rmi_hid_open,
+	.close		= rmi_hid_close,
+};
+
+/*
+ * Mock transport: a flat 64k register image in memory. Used to time the
+ * function layer (PDT scan, populate, attention decode) without any bus
+ * cost.
+ */
+
+#define RMI_MOCK_REGS_SIZE		0x10000
+
+static int rmi_mock_read_block(struct rmi_data *data, u16 addr, void *buf,
+		const int len)
+{
+	u8 *regs = data->xport_priv;
+
+	if (addr + len > RMI_MOCK_REGS_SIZE)
+		return -EINVAL;
+
+	memcpy(buf, regs + addr, len);
+	return 0;
+}
+
+static int rmi_mock_write_block(struct rmi_data *data, u16 addr,
+		const void *buf, const int len)
+{
+	u8 *regs = data->xport_priv;
+
+	if (addr + len > RMI_MOCK_REGS_SIZE)
+		return -EINVAL;
+
+	memcpy(regs + addr, buf, len);
+	return 0;
+}
+
+static const struct rmi_transport_ops rmi_mock_ops = {
+	.name		= "mock",
+	.read_block	= rmi_mock_read_block,
+	.write_block	= rmi_mock_write_block,
+};
+
+/* longer than a resume, shorter than the read timeout of the HID transport */
+#define RMI_MOCK_STALL_MS		500
+
+/* reads stall like a sensor which stopped answering, until aborted */
+static int rmi_mock_stall_read_block(struct rmi_data *data, u16 addr,
+		void *buf, const int len)
+{
+	if (wait_event_timeout(data->wait, rmi_xfer_aborted(data),
+			       msecs_to_jiffies(RMI_MOCK_STALL_MS)))
+		return -ECANCELED;
+
+	return rmi_mock_read_block(data, addr, buf, len);
+}
+
+static const struct rmi_transport_ops rmi_mock_stall_ops = {
+	.name		= "mock-stall",
+	.read_block	= rmi_mock_stall_read_block,
+	.write_block	= rmi_mock_write_block,
+};
+
+#if IS_ENABLED(CONFIG_I2C)
+/*
+ * Native I2C transport: the registers are addressed directly with an 8 bit
+ * offset inside the current page, no report framing. Adapters which can
+ * not do plain I2C transfers (e.g. i2c-stub) are driven with SMBus I2C
+ * block transfers instead.
+ */
+
+#define RMI_I2C_MAX_WRITE		I2C_SMBUS_BLOCK_MAX
+
+/*
+ * The caller selected the page of @addr. A block going on past the end of
+ * the page is split there, and the rest is addressed in the next page
+ * instead of wrapping around to the start of the current one.
+ */
+static int rmi_i2c_chunk(struct rmi_data *data, u16 addr, int offset,
+		int len, int max)
+{
+	u16 cur = addr + offset;
+	int ret;
+
+	if (offset && !(cur & 0xff)) {
+		ret = rmi_set_page(data, RMI_PAGE(cur));
+		if (ret)
+			return ret;
+	}
+
+	return min3(len - offset, max, 0x100 - (cur & 0xff));
+}
+
+static int rmi_i2c_read_block(struct rmi_data *data, u16 addr, void *buf,
+		const int len)
+{
+	struct i2c_client *client = data->xport_priv;
+	bool plain = i2c_check_functionality(client->adapter, I2C_FUNC_I2C);
+	struct i2c_msg msgs[2];
+	int offset;
+	int chunk;
+	u8 reg;
+	int ret;
+
+	for (offset = 0; offset < len; offset += chunk) {
+		chunk = rmi_i2c_chunk(data, addr, offset, len,
+				      plain ? len : I2C_SMBUS_BLOCK_MAX);
+		if (chunk < 0)
+			return chunk;
+
+		reg = (addr + offset) & 0xff;
+		if (!plain) {
+			ret = i2c_smbus_read_i2c_block_data(client, reg, chunk,
+					buf + offset);
+			if (ret != chunk)
+				return ret < 0 ? ret : -EIO;
+			continue;
+		}
+
+		msgs[0] = (struct i2c_msg){ .addr = client->addr, .len = 1,
+					    .buf = &reg };
+		msgs[1] = (struct i2c_msg){ .addr = client->addr,
+					    .flags = I2C_M_RD, .len = chunk,
+					    .buf = buf + offset };
+		ret = i2c_transfer(client->adapter, msgs, ARRAY_SIZE(msgs));
+		if (ret != ARRAY_SIZE(msgs))
+			return ret < 0 ? ret : -EIO;
+	}
+
+	return 0;
+}
+
+static int rmi_i2c_write_block(struct rmi_data *data, u16 addr,
+		const void *buf, const int len)
+{
+	struct i2c_client *client = data->xport_priv;
+	bool plain = i2c_check_functionality(client->adapter, I2C_FUNC_I2C);
+	u8 txbuf[RMI_I2C_MAX_WRITE + 1];
+	int offset;
+	int chunk;
+	int ret;
+
+	for (offset = 0; offset < len; offset += chunk) {
+		chunk = rmi_i2c_chunk(data, addr, offset, len,
+				      RMI_I2C_MAX_WRITE);
+		if (chunk < 0)
+			return chunk;
+
+		if (!plain) {
+			ret = i2c_smbus_write_i2c_block_data(client,
+					(addr + offset) & 0xff, chunk,
+					buf + offset);
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		txbuf[0] = (addr + offset) & 0xff;
+		memcpy(&txbuf[1], buf + offset, chunk);
+
+		ret = i2c_master_send(client, txbuf, chunk + 1);
+		if (ret != chunk + 1)
+			return ret < 0 ? ret : -EIO;
+	}
+
+	return 0;
+}
+
+static int rmi_i2c_open(struct rmi_data *data)
+{
+	return pm_runtime_resume_and_get(data->dev);
+}
+
+static void rmi_i2c_close(struct rmi_data *data)
+{
+	pm_runtime_mark_last_busy(data->dev);
+	pm_runtime_put_autosuspend(data->dev);
+}
+
+static const struct rmi_transport_ops rmi_i2c_ops = {
+	.name		= "i2c",
+	.read_block	= rmi_i2c_read_block,
+	.write_block	= rmi_i2c_write_block,
+	.open		= rmi_i2c_open,
+	.close		= rmi_i2c_close,
+};
+#endif /* CONFIG_I2C */
+
+/* returns whether the contact appeared, moved or was lifted */
+static bool rmi_f11_process_touch(struct rmi_f11_sensor *sensor, int slot,
+		u8 finger_state, u8 *touch_data, bool hide)
+{
+	struct input_dev *input = sensor->input;
+	struct rmi_slot *s = &sensor->slots[slot];
+	bool moved = s->active != (finger_state == 0x01);
+	bool landed = !s->active;
+	int x, y, wx, wy;
+	int wide, major, minor;
+	int z;
+
+	input_mt_slot(input, slot);
+	input_mt_report_slot_state(input, MT_TOOL_FINGER,
+			finger_state == 0x01 && !hide);
+	s->active = finger_state == 0x01;
+	if (finger_state == 0x01) {
+		x = (touch_data[0] << 4) | (touch_data[2] & 0x0F);
+		y = (touch_data[1] << 4) | (touch_data[2] >> 4);
+		wx = touch_data[3] & 0x0F;
+		wy = touch_data[3] >> 4;
+		wide = (wx > wy);
+		major = max(wx, wy);
+		minor = min(wx, wy);
+		z = touch_data[4];
+
+		/* y is inverted */
+		y = sensor->max_y - y;
+
+		/* the rate policy ignores motion under the sensor thresholds */
+		if (landed ||
+		    ((s->x != x || s->y != y) &&
+		     (abs(x - s->motion_x) >= sensor->motion_x ||
+		      abs(y - s->motion_y) >= sensor->motion_y))) {
+			moved = true;
+			s->motion_x = x;
+			s->motion_y = y;
+		}
+		s->x = x;
+		s->y = y;
+
+		if (hide)
+			return moved;
+
+		input_event(input, EV_ABS, ABS_MT_POSITION_X, x);
+		input_event(input, EV_ABS, ABS_MT_POSITION_Y, y);
+		input_event(input, EV_ABS, ABS_MT_ORIENTATION, wide);
+		input_event(input, EV_ABS, ABS_MT_PRESSURE, z);
+		input_event(input, EV_ABS, ABS_MT_TOUCH_MAJOR, major);
+		input_event(input, EV_ABS, ABS_MT_TOUCH_MINOR, minor);
+	}
+
+	return moved;
+}
+
+static void rmi_scroll_axis(struct input_dev *input, int *acc, int *hires,
+		int delta, int detent, unsigned int hires_code,
+		unsigned int code)
+{
+	int value;
+
+	*acc += delta * RMI_WHEEL_HI_RES_DETENT;
+	value = *acc / detent;
+	if (!value)
+		return;
+
+	*acc -= value * detent;
+	input_report_rel(input, hires_code, value);
+
+	*hires += value;
+	if (abs(*hires) >= RMI_WHEEL_HI_RES_DETENT) {
+		input_report_rel(input, code,
+				 *hires / RMI_WHEEL_HI_RES_DETENT);
+		*hires %= RMI_WHEEL_HI_RES_DETENT;
+	}
+}
+
+/*
+ * Two contacts down and moving together scroll: the motion of their
+ * centroid is turned into hi-res wheel events, one detent every
+ * RMI_SCROLL_DETENT_MM of travel. While the scroll device is open, the
+ * main device releases the two contacts when the scroll starts and hides
+ * them until it ends, so that userspace does not scroll a second time.
+ */
+static void rmi_scroll_frame(struct rmi_data *hdata)
+{
+	struct rmi_f11_sensor *sensor = &hdata->sensors[0];
+	struct rmi_scroll *scroll = &hdata->scroll;
+	int count = 0;
+	int x = 0, y = 0;
+	int i;
+
+	for (i = 0; i < sensor->max_fingers; i++) {
+		if (!sensor->slots[i].active)
+			continue;
+		count++;
+		x += sensor->slots[i].x;
+		y += sensor->slots[i].y;
+	}
+
+	if (count != 2) {
+		scroll->tracking = false;
+		scroll->scrolling = false;
+		return;
+	}
+
+	x /= 2;
+	y /= 2;
+
+	if (!scroll->tracking) {
+		scroll->tracking = true;
+		scroll->scrolling = false;
+		scroll->start_x = x;
+		scroll->start_y = y;
+		return;
+	}
+
+	if (!scroll->scrolling) {
+		if (abs(x - scroll->start_x) <
+				RMI_SCROLL_START_MM * scroll->units_x &&
+		    abs(y - scroll->start_y) <
+				RMI_SCROLL_START_MM * scroll->units_y)
+			return;
+
+		scroll->scrolling = true;
+		scroll->last_x = x;
+		scroll->last_y = y;
+		scroll->acc_x = scroll->acc_y = 0;
+		scroll->hires_x = scroll->hires_y = 0;
+
+		if (READ_ONCE(scroll->open)) {
+			for (i = 0; i < sensor->max_fingers; i++) {
+				if (!sensor->slots[i].active)
+					continue;
+				input_mt_slot(sensor->input, i);
+				input_mt_report_slot_state(sensor->input,
+						MT_TOOL_FINGER, false);
+			}
+			input_mt_sync_frame(sensor->input);
+			input_sync(sensor->input);
+		}
+		return;
+	}
+
+	/* y grows downwards, moving the fingers down scrolls down */
+	rmi_scroll_axis(scroll->input, &scroll->acc_y, &scroll->hires_y,
+			scroll->last_y - y,
+			RMI_SCROLL_DETENT_MM * scroll->units_y,
+			REL_WHEEL_HI_RES, REL_WHEEL);
+	rmi_scroll_axis(scroll->input, &scroll->acc_x, &scroll->hires_x,
+			x - scroll->last_x,
+			RMI_SCROLL_DETENT_MM * scroll->units_x,
+			REL_HWHEEL_HI_RES, REL_HWHEEL);
+	input_sync(scroll->input);
+
+	scroll->last_x = x;
+	scroll->last_y = y;
+}
+
+static void rmi_reset_work(struct work_struct *work)
+{
+	struct rmi_data *hdata = container_of(work, struct rmi_data,
+						reset_work);
+	struct rmi_recovery_stats *stats = &hdata->recovery_stats;
+	u64 start = READ_ONCE(hdata->reset_start_ns);
+	u64 elapsed;
+	int ret;
+
+	WRITE_ONCE(hdata->reset_start_ns, 0);
+
+	/* switch the device to RMI if we receive a generic mouse report */
+	rmi_urgent_begin(hdata);
+	ret = rmi_set_mode(hdata, RMI_MODE_ATTN_REPORTS);
+	rmi_urgent_end(hdata);
+
+	if (ret < 0 || !start)
+		return;
+
+	elapsed = ktime_get_ns() - start;
+	stats->resets++;
+	stats->reset_ns += elapsed;
+	if (elapsed > stats->reset_max_ns)
+		stats->reset_max_ns = elapsed;
+}
+
+static inline int rmi_schedule_reset(struct hid_device *hdev)
+{
+	struct rmi_data *hdata = hid_get_drvdata(hdev);
+
+	/* rmi_remove() cancels the reset after the last report went through */
+	if (READ_ONCE(hdata->xfer_state) == RMI_XFER_DYING)
+		return 0;
+
+	if (!READ_ONCE(hdata->reset_start_ns))
+		WRITE_ONCE(hdata->reset_start_ns, ktime_get_ns());
+	return queue_work(rmi_wq, &hdata->reset_work);
+}
+
+/*
+ * One MSC_GESTURE event per detected gesture, its flag in the low byte:
+ * a flick adds its X and Y distance and its duration (10 ms units) in the
+ * next bytes, a pinch its motion in the second byte.
+ */
+static void rmi_f11_report_gestures(struct rmi_data *hdata,
+		struct rmi_f11_sensor *sensor, const u8 *gesture)
+{
+	unsigned long flags = gesture[0] & sensor->gestures;
+	u32 value;
+	int bit;
+
+	for_each_set_bit(bit, &flags, 8) {
+		value = BIT(bit);
+		if (value == RMI_F11_GESTURE_FLICK)
+			value |= gesture[2] << 8 | gesture[3] << 16 |
+				 (u32)gesture[4] << 24;
+		else if (value == RMI_F11_GESTURE_PINCH)
+			value |= gesture[2] << 8;
+
+		input_event(sensor->input, EV_MSC, MSC_GESTURE, value);
+		hdata->attn_stats.gestures++;
+	}
+}
+
+/* a palm stays flagged for as long as it lies on the sensor */
+static void rmi_f11_palm_event(struct rmi_data *hdata,
+		struct rmi_f11_sensor *sensor, u8 flags)
+{
+	bool palm = flags & RMI_F11_GESTURE2_PALM;
+
+	if (palm) {
+		hdata->attn_stats.palm_frames++;
+		if (!sensor->palm)
+			hdata->attn_stats.palms++;
+	}
+	sensor->palm = palm;
+}
+
+/* @data points to the data of the sensor, returns whether a contact moved */
+static bool rmi_f11_sensor_event(struct rmi_data *hdata,
+		struct rmi_f11_sensor *sensor, u8 *data)
+{
+	bool moved = false;
+	bool hide;
+	int i;
+
+	/* not registered */
+	if (!sensor->input)
+		return false;
+
+	hide = sensor == &hdata->sensors[0] && hdata->scroll.scrolling &&
+	       READ_ONCE(hdata->scroll.open);
+
+	for (i = 0; i < sensor->max_fingers; i++) {
+		int fs_byte_position = i >> 2;
+		int fs_bit_position = (i & 0x3) << 1;
+		int finger_state = (data[fs_byte_position] >> fs_bit_position) &
+					0x03;
+
+		moved |= rmi_f11_process_touch(sensor, i, finger_state,
+				&data[sensor->abs_offset + 5 * i], hide);
+	}
+
+	if (sensor->gestures)
+		rmi_f11_report_gestures(hdata, sensor,
+				&data[sensor->gesture_offset]);
+
+	if (sensor->palm_detect)
+		rmi_f11_palm_event(hdata, sensor, data[sensor->gesture_offset +
+				!!sensor->gesture_query[0]]);
+
+	input_mt_sync_frame(sensor->input);
+	input_sync(sensor->input);
+
+	return moved;
+}
+
+static int rmi_f11_input_event(struct rmi_data *hdata, u8 irq, u8 *data,
+		int size)
+{
+	struct rmi_f11_sensor *sensor;
+	bool moved = false;
+	int i;
+
+	if (size < hdata->f11.report_size)
+		return 0;
+
+	if (!(irq & hdata->f11.irq_mask))
+		return 0;
+
+	for (i = 0; i < hdata->sensor_count; i++) {
+		sensor = &hdata->sensors[i];
+		moved |= rmi_f11_sensor_event(hdata, sensor,
+				&data[sensor->data_offset]);
+	}
+
+	if (hdata->scroll.input)
+		rmi_scroll_frame(hdata);
+
+	if (hdata->rate.enabled)
+		rmi_rate_frame(hdata, moved);
+
+	return hdata->f11.report_size;
+}
+
+static int rmi_f30_input_event(struct rmi_data *hdata, u8 irq, u8 *data,
+		int size)
+{
+	int i;
+	int button = 0;
+	bool value;
+
+	if (!(irq & hdata->f30.irq_mask))
+		return 0;
+
+	if (size < hdata->f30.report_size)
+		return 0;
+
+	for (i = 0; i < hdata->gpio_led_count; i++) {
+		if (test_bit(i, &hdata->button_mask)){
+			value = (data[i / 8] >> (i & 0x07)) & BIT(0);
+			if (test_bit(i, &hdata->button_state_mask))
+				value = !value;
+			input_event(hdata->input, EV_KEY, BTN_LEFT + button++,
+					value);
+		}
+	}
+	return hdata->f30.report_size;
+}
+
+/*
+ * Size of the attention payload (after the report id and the interrupt
+ * status byte) for the interrupt sources flagged in @irq.
+ */
+static int rmi_attn_payload_size(struct rmi_data *hdata, u8 irq)
+{
+	int size = 0;
+
+	if (irq & hdata->f11.irq_mask)
+		size += hdata->f11.report_size;
+	if (irq & hdata->f30.irq_mask)
+		size += hdata->f30.report_size;
+
+	return size;
+}
+
+/*
+ * Size of the biggest attention frame the device can send: report id,
+ * interrupt status, then the data of every function we decode.
+ */
+static inline int rmi_attn_frame_size(struct rmi_data *data)
+{
+	return 2 + data->f11.report_size + data->f30.report_size;
+}
+
+/* running totals, the counts in between are in debugfs attn_stats */
+static void rmi_event_log(struct rmi_data *data)
+{
+	struct rmi_event_stats *stats = &data->event_stats;
+
+	if (!__ratelimit(&data->event_rs))
+		return;
+
+	rmi_warn(data,
+		 "dropped reports: %llu with unknown intr sources (%02lx), %llu stray read data, %llu short read data\n",
+		 stats->unknown_irq, stats->unknown_irq_mask,
+		 stats->stray_reads, stats->short_reads);
+}
+
+/*
+ * Attention frame layout, as seen by rmi_input_event() and by any HID-BPF
+ * program attached to the device (those run before .raw_event and may
+ * rewrite the report in place or change its size):
+ *
+ *   byte 0	RMI_ATTN_REPORT_ID
+ *   byte 1	interrupt status, one bit per interrupt source
+ *   byte 2..	one data block per function whose interrupt bit is set, in
+ *		interrupt order:
+ *		F11: for each 2D sensor, in sensor order,
+ *		     DIV_ROUND_UP(max_fingers, 4) finger state bytes (2 bits
+ *		     per finger, 1 == present), then 5 bytes per finger:
+ *		     X[11:4], Y[11:4], Y[3:0] << 4 | X[3:0], Wy << 4 | Wx, Z,
+ *		     then 2 bytes per finger with relative reporting, then
+ *		     the gesture flags and data when the device has gestures
+ *		F30: one bit per GPIO/LED
+ *
+ * A frame longer than an input report continues in the next attention
+ * reports, each made of the report id and the following bytes of the
+ * frame; the pieces are reassembled before decoding, so a HID-BPF program
+ * sees them one by one.
+ *
+ * The per device offsets are exported in debugfs (attn_layout). Clearing
+ * the bits of byte 1 drops the frame (it is then left to hidraw), a frame
+ * shorter than its flagged blocks is rejected as a whole.
+ */
+static int rmi_input_event(struct rmi_data *hdata, u8 *data, int size)
+{
+	unsigned long irq_mask = 0;
+	unsigned index = 2;
+	u64 start, elapsed;
+
+	if (!(test_bit(RMI_STARTED, &hdata->flags)))
+		return 0;
+
+	if (test_bit(RMI_WAKE_PENDING, &hdata->flags))
+		rmi_wake_frame(hdata);
+
+	if (size < 2 || size - 2 < rmi_attn_payload_size(hdata, data[1])) {
+		hdata->attn_stats.short_frames++;
+		return 0;
+	}
+
+	start = ktime_get_ns();
+
+	irq_mask |= hdata->f11.irq_mask;
+	irq_mask |= hdata->f30.irq_mask;
+
+	if (!(data[1] & irq_mask))
+		/*
+		 * No intr sources which are supported by this
+		 * driver were found. Return 0 and let the report
+		 * go to hidraw in case there is a userspace tool
+		 * handling these intr sources.
+		 */
+		return 0;
+
+	if (data[1] & ~irq_mask) {
+		hdata->event_stats.unknown_irq++;
+		hdata->event_stats.unknown_irq_mask |= data[1] & ~irq_mask;
+		rmi_event_log(hdata);
+	}
+
+	if (hdata->f11.interrupt_base < hdata->f30.interrupt_base) {
+		index += rmi_f11_input_event(hdata, data[1], &data[index],
+				size - index);
+		index += rmi_f30_input_event(hdata, data[1], &data[index],
+				size - index);
+	} else {
+		index += rmi_f30_input_event(hdata, data[1], &data[index],
+				size - index);
+		index += rmi_f11_input_event(hdata, data[1], &data[index],
+				size - index);
+	}
+
+	elapsed = ktime_get_ns() - start;
+	hdata->attn_stats.frames++;
+	hdata->attn_stats.decode_ns += elapsed;
+	if (elapsed > hdata->attn_stats.decode_max_ns)
+		hdata->attn_stats.decode_max_ns = elapsed;
+
+	return 1;
+}
+
+static void rmi_attn_latency(struct rmi_data *hdata, u64 ts)
+{
+	u64 elapsed = ktime_get_ns() - ts;
+
+	hdata->attn_stats.latency_frames++;
+	hdata->attn_stats.latency_ns += elapsed;
+	if (elapsed > hdata->attn_stats.latency_max_ns)
+		hdata->attn_stats.latency_max_ns = elapsed;
+}
+
+static void rmi_ring_work(struct work_struct *work)
+{
+	struct rmi_data *hdata = container_of(work, struct rmi_data,
+					      ring.work);
+	struct rmi_ring *ring = &hdata->ring;
+	unsigned int tail = ring->tail;
+	struct rmi_ring_slot *slot;
+	unsigned long flags;
+
+	while (tail != smp_load_acquire(&ring->head)) {
+		slot = &ring->slots[tail & (RMI_RING_SIZE - 1)];
+
+		spin_lock_irqsave(&hdata->poll.lock, flags);
+		if (rmi_input_event(hdata, slot->data, slot->len))
+			rmi_attn_latency(hdata, slot->ts);
+		spin_unlock_irqrestore(&hdata->poll.lock, flags);
+
+		/* hand the slot back to the producer */
+		smp_store_release(&ring->tail, ++tail);
+	}
+}
+
+/*
+ * Hands a frame to the decode work. Only the transport completion calls
+ * this, and only the work consumes, so the ring needs no lock.
+ */
+static int rmi_ring_push(struct rmi_data *hdata, u8 *data, int size, u64 ts)
+{
+	struct rmi_ring *ring = &hdata->ring;
+	unsigned int head = ring->head;
+	struct rmi_ring_slot *slot;
+
+	/* nothing to decode for, and the work may be cancelled already */
+	if (!test_bit(RMI_STARTED, &hdata->flags))
+		return 0;
+
+	if (head - smp_load_acquire(&ring->tail) >= RMI_RING_SIZE) {
+		hdata->attn_stats.overruns++;
+		return 1;
+	}
+
+	slot = &ring->slots[head & (RMI_RING_SIZE - 1)];
+	slot->len = min(size, rmi_attn_frame_size(hdata));
+	memcpy(slot->data, data, slot->len);
+	slot->ts = ts;
+	smp_store_release(&ring->head, head + 1);
+
+	queue_work(system_highpri_wq, &ring->work);
+	return 1;
+}
+
+/* decode an attention frame now, or queue it for the decode work */
+static int rmi_attn_dispatch(struct rmi_data *hdata, u8 *data, int size,
+		u64 ts)
+{
+	unsigned long irq_mask = hdata->f11.irq_mask | hdata->f30.irq_mask;
+	unsigned long flags;
+	int ret;
+
+	/* frames for nobody are left to hidraw right away */
+	if (hdata->ring.enabled && size >= 2 && (data[1] & irq_mask))
+		return rmi_ring_push(hdata, data, size, ts);
+
+	spin_lock_irqsave(&hdata->poll.lock, flags);
+	ret = rmi_input_event(hdata, data, size);
+	if (ret)
+		rmi_attn_latency(hdata, ts);
+	spin_unlock_irqrestore(&hdata->poll.lock, flags);
+
+	return ret;
+}
+
+static void rmi_ring_init(struct rmi_data *hdata)
+{
+	struct rmi_ring *ring = &hdata->ring;
+	int size = rmi_attn_frame_size(hdata);
+	u8 *buf;
+	int i;
+
+	if (!threaded_decode)
+		return;
+
+	buf = devm_kcalloc(hdata->dev, RMI_RING_SIZE, size, GFP_KERNEL);
+	if (!buf)
+		return;
+
+	for (i = 0; i < RMI_RING_SIZE; i++)
+		ring->slots[i].data = buf + i * size;
+
+	ring->enabled = true;
+}
+
+static enum hrtimer_restart rmi_attn_expire(struct hrtimer *timer)
+{
+	struct rmi_data *hdata = container_of(timer, struct rmi_data,
+					      attn_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&hdata->attn_lock, flags);
+	if (hdata->attn_need) {
+		hdata->attn_need = 0;
+		hdata->attn_stats.incomplete_frames++;
+	}
+	spin_unlock_irqrestore(&hdata->attn_lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Attention frames of big sensors (10 fingers and buttons) do not fit in
+ * one input report and are split over several ones. A full sized report
+ * announcing more data than it holds starts a frame in attn_frame, the
+ * following reports complete it. A continuation is a full report, or
+ * exactly the rest of the frame, received within RMI_ATTN_CONT_TIMEOUT_NS
+ * of the previous piece. attn_timer drops a frame whose rest never comes,
+ * so that it is counted even if no report follows.
+ */
+static int rmi_hid_attn_event(struct rmi_data *hdata, u8 *data, int size,
+		u64 now)
+{
+	unsigned long flags;
+	int remaining;
+	int chunk;
+
+	spin_lock_irqsave(&hdata->attn_lock, flags);
+
+	if (hdata->attn_need) {
+		remaining = hdata->attn_need - hdata->attn_len;
+		if (now - hdata->attn_ts <= RMI_ATTN_CONT_TIMEOUT_NS &&
+		    (size == hdata->input_report_size ||
+		     size - 1 == remaining)) {
+			chunk = min(size - 1, remaining);
+			memcpy(hdata->attn_frame + hdata->attn_len, &data[1],
+			       chunk);
+			hdata->attn_len += chunk;
+			hdata->attn_ts = now;
+			if (hdata->attn_len < hdata->attn_need) {
+				hrtimer_start(&hdata->attn_timer,
+					ns_to_ktime(RMI_ATTN_CONT_TIMEOUT_NS),
+					HRTIMER_MODE_REL);
+				spin_unlock_irqrestore(&hdata->attn_lock, flags);
+				return 1;
+			}
+
+			hdata->attn_need = 0;
+			hdata->attn_stats.reassembled_frames++;
+			spin_unlock_irqrestore(&hdata->attn_lock, flags);
+			hrtimer_try_to_cancel(&hdata->attn_timer);
+			return rmi_attn_dispatch(hdata, hdata->attn_frame,
+					hdata->attn_len, now);
+		}
+
+		/* late or of the wrong size, this is a new frame */
+		hdata->attn_need = 0;
+		hdata->attn_stats.incomplete_frames++;
+	}
+
+	if (hdata->attn_frame && size >= 2 &&
+	    size == hdata->input_report_size) {
+		int need = 2 + rmi_attn_payload_size(hdata, data[1]);
+
+		if (need > size && need <= rmi_attn_frame_size(hdata)) {
+			memcpy(hdata->attn_frame, data, size);
+			hdata->attn_len = size;
+			hdata->attn_need = need;
+			hdata->attn_ts = now;
+			hrtimer_start(&hdata->attn_timer,
+				      ns_to_ktime(RMI_ATTN_CONT_TIMEOUT_NS),
+				      HRTIMER_MODE_REL);
+			spin_unlock_irqrestore(&hdata->attn_lock, flags);
+			return 1;
+		}
+	}
+
+	spin_unlock_irqrestore(&hdata->attn_lock, flags);
+
+	return rmi_attn_dispatch(hdata, data, size, now);
+}
+
+static int rmi_read_data_event(struct hid_device *hdev, u8 *data, int size)
+{
+	struct rmi_data *hdata = hid_get_drvdata(hdev);
+	struct rmi_xfer *xfer = READ_ONCE(hdata->xfer_read);
+
+	if (!test_bit(RMI_READ_REQUEST_PENDING, &hdata->flags) || !xfer) {
+		hdata->event_stats.stray_reads++;
+		rmi_event_log(hdata);
+		return 0;
+	}
+
+	/* cut short: leave it to the reader to time out and retry */
+	if (size < 2 || data[1] > size - 2) {
+		hdata->event_stats.short_reads++;
+		rmi_event_log(hdata);
+		return 1;
+	}
+
+	memcpy(xfer->in, data, size < hdata->input_report_size ?
+			size : hdata->input_report_size);
+	set_bit(RMI_READ_DATA_PENDING, &hdata->flags);
+	wake_up(&hdata->wait);
+
+	return 1;
+}
+
+/*
+ * Returns true if the report was consumed by a fault: dropped, held back to
+ * be replayed later, or turned into a reset. A truncated report goes on with
+ * its new @size, always keeping the report id.
+ */
+static bool rmi_fault_inject(struct rmi_data *hdata,
+		enum rmi_fault_report type, u8 *data, int *size)
+{
+	struct rmi_fault *fault = &hdata->faults[type];
+	unsigned int roll;
+
+	if (!READ_ONCE(hdata->faults_armed))
+		return false;
+
+	fault->stats.reports++;
+	roll = get_random_u32_below(100);
+
+	if (roll < fault->drop) {
+		fault->stats.dropped++;
+		return true;
+	}
+	roll -= fault->drop;
+
+	if (roll < fault->truncate) {
+		if (*size > 1)
+			*size = 1 + get_random_u32_below(*size - 1);
+		fault->stats.truncated++;
+		return false;
+	}
+	roll -= fault->truncate;
+
+	if (roll < fault->delay) {
+		/* one report held back at a time, the others go through */
+		if (!fault->held || *size > hdata->input_report_size ||
+		    smp_load_acquire(&fault->held_len))
+			return false;
+
+		memcpy(fault->held, data, *size);
+		smp_store_release(&fault->held_len, *size);
+		queue_delayed_work(rmi_wq, &fault->work,
+				   msecs_to_jiffies(fault->delay_ms));
+		fault->stats.delayed++;
+		return true;
+	}
+	roll -= fault->delay;
+
+	if (roll < fault->reset) {
+		fault->stats.resets++;
+		rmi_schedule_reset(hdata->hdev);
+		return true;
+	}
+
+	return false;
+}
+
+/* called with event_lock held, @inject is false for the replays */
+static int rmi_report_event(struct rmi_data *hdata, u8 *data, int size,
+		bool inject)
+{
+	struct hid_device *hdev = hdata->hdev;
+	u64 start, elapsed;
+	int ret;
+
+	rmi_trace(hdata, RMI_TRACE_IN, data[0], 0, size, 0, ktime_get_ns());
+
+	switch (data[0]) {
+	case RMI_READ_DATA_REPORT_ID:
+		if (inject && rmi_fault_inject(hdata, RMI_FAULT_READ,
+					       data, &size))
+			return 1;
+		return rmi_read_data_event(hdev, data, size);
+	case RMI_ATTN_REPORT_ID:
+		if (inject && rmi_fault_inject(hdata, RMI_FAULT_ATTN,
+					       data, &size))
+			return 1;
+		start = ktime_get_ns();
+		rmi_poll_attention(hdata);
+		ret = rmi_hid_attn_event(hdata, data, size, start);
+
+		/* time spent in the transport completion */
+		elapsed = ktime_get_ns() - start;
+		hdata->attn_stats.irq_frames++;
+		hdata->attn_stats.irq_ns += elapsed;
+		if (elapsed > hdata->attn_stats.irq_max_ns)
+			hdata->attn_stats.irq_max_ns = elapsed;
+		return ret;
+	case RMI_MOUSE_REPORT_ID:
+		rmi_schedule_reset(hdev);
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * A delayed report is replayed straight into the driver. Going through
+ * hid_input_report() again would not do: hid-core only try-locks its
+ * driver input lock, so the real reports coming in meanwhile would be
+ * dropped with -EBUSY, unaccounted. Here they wait for the replay instead.
+ */
+static void rmi_fault_work(struct work_struct *work)
+{
+	struct rmi_fault *fault = container_of(to_delayed_work(work),
+					       struct rmi_fault, work);
+	struct rmi_data *hdata = fault->data;
+	int len = smp_load_acquire(&fault->held_len);
+	unsigned long flags;
+
+	spin_lock_irqsave(&hdata->event_lock, flags);
+	rmi_report_event(hdata, fault->held, len, false);
+	spin_unlock_irqrestore(&hdata->event_lock, flags);
+
+	smp_store_release(&fault->held_len, 0);
+}
+
+static int rmi_raw_event(struct hid_device *hdev,
+		struct hid_report *report, u8 *data, int size)
+{
+	struct rmi_data *hdata = hid_get_drvdata(hdev);
+	unsigned long flags;
+	int ret;
+
+	/* a HID-BPF program may have shrunk the report */
+	if (size < 1)
+		return 0;
+
+	spin_lock_irqsave(&hdata->event_lock, flags);
+	ret = rmi_report_event(hdata, data, size, true);
+	spin_unlock_irqrestore(&hdata->event_lock, flags);
+
+	return ret;
+}
+
+/* the i2c-hid client, or the usb interface or its usb device */
+static struct device *rmi_hid_wakeup_dev(struct hid_device *hdev)
+{
+	struct device *parent = hdev->dev.parent;
+
+	if (!parent)
+		return NULL;
+	if (device_may_wakeup(parent))
+		return parent;
+	if (parent->parent && device_may_wakeup(parent->parent))
+		return parent->parent;
+	return NULL;
+}
+
+static int rmi_hid_suspend(struct hid_device *hdev, pm_message_t message)
+{
+	struct rmi_data *data = hid_get_drvdata(hdev);
+
+	/*
+	 * An open device is only autosuspended by usbhid when it can wake
+	 * up remotely, the sensor keeps reporting so that a touch still gets
+	 * through. That is no system wake event.
+	 */
+	if (PMSG_IS_AUTO(message))
+		return rmi_suspend(data, RMI_SUSPEND_IDLE);
+
+	data->wake_dev = rmi_hid_wakeup_dev(hdev);
+	return rmi_suspend(data, data->wake_dev ? RMI_SUSPEND_WAKE :
+						  RMI_SUSPEND_SLEEP);
+}
+
+static int rmi_post_reset(struct hid_device *hdev)
+{
+	return rmi_resume(hid_get_drvdata(hdev), true);
+}
+
+static int rmi_post_resume(struct hid_device *hdev)
+{
+	return rmi_resume(hid_get_drvdata(hdev), false);
+}
+
+#define RMI4_MAX_PAGE 0xff
+#define RMI4_PAGE_SIZE 0x0100
+
+#define PDT_START_SCAN_LOCATION 0x00e9
+#define PDT_END_SCAN_LOCATION	0x0005
+#define RMI4_END_OF_PDT(id) ((id) == 0x00 || (id) == 0xff)
+
+struct pdt_entry {
+	u8 query_base_addr:8;
+	u8 command_base_addr:8;
+	u8 control_base_addr:8;
+	u8 data_base_addr:8;
+	u8 interrupt_source_count:3;
+	u8 bits3and4:2;
+	u8 function_version:2;
+	u8 bit7:1;
+	u8 function_number:8;
+} __attribute__((__packed__));
+
+static inline unsigned long rmi_gen_mask(unsigned irq_base, unsigned irq_count)
+{
+	return GENMASK(irq_count + irq_base - 1, irq_base);
+}
+
+static void rmi_register_function(struct rmi_data *data,
+	struct pdt_entry *pdt_entry, int page, unsigned interrupt_count)
+{
+	struct rmi_function *f = NULL;
+	u16 page_base = page << 8;
+
+	switch (pdt_entry->function_number) {
+	case 0x01:
+		f = &data->f01;
+		break;
+	case 0x11:
+		f = &data->f11;
+		break;
+	case 0x30:
+		f = &data->f30;
+		break;
+	case 0x34:
+		f = &data->f34;
+		break;
+	}
+
+	if (f) {
+		f->page = page;
+		f->query_base_addr = page_base | pdt_entry->query_base_addr;
+		f->command_base_addr = page_base | pdt_entry->command_base_addr;
+		f->control_base_addr = page_base | pdt_entry->control_base_addr;
+		f->data_base_addr = page_base | pdt_entry->data_base_addr;
+		f->interrupt_base = interrupt_count;
+		f->interrupt_count = pdt_entry->interrupt_source_count;
+		f->irq_mask = rmi_gen_mask(f->interrupt_base,
+						f->interrupt_count);
+	}
+}
+
+static int rmi_scan_pdt(struct rmi_data *data)
+{
+	struct pdt_entry entry;
+	int page;
+	bool page_has_function;
+	int i;
+	int retval;
+	int interrupt = 0;
+	u16 page_start, pdt_start , pdt_end;
+
+	dev_dbg(data->dev, "Scanning PDT...\n");
+
+	/*
+	 * After a reflash, a function gone from the PDT must not keep the
+	 * registers, sizes and caches of the previous firmware.
+	 */
+	mutex_lock(&data->page_mutex);
+	memset(&data->f01, 0, sizeof(data->f01));
+	memset(&data->f11, 0, sizeof(data->f11));
+	memset(&data->f30, 0, sizeof(data->f30));
+	memset(&data->f34, 0, sizeof(data->f34));
+	mutex_unlock(&data->page_mutex);
+
+	for (page = 0; (page <= RMI4_MAX_PAGE); page++) {
+		page_start = RMI4_PAGE_SIZE * page;
+		pdt_start = page_start + PDT_START_SCAN_LOCATION;
+		pdt_end = page_start + PDT_END_SCAN_LOCATION;
+
+		page_has_function = false;
+		for (i = pdt_start; i >= pdt_end; i -= sizeof(entry)) {
+			retval = rmi_read_block(data, i, &entry, sizeof(entry));
+			if (retval) {
+				rmi_err(data,
+					"Read of PDT entry at %#06x failed.\n",
+					i);
+				goto error_exit;
+			}
+
+			if (RMI4_END_OF_PDT(entry.function_number))
+				break;
+
+			page_has_function = true;
+
+			dev_dbg(data->dev, "Found F%02X on page %#04x\n",
+					entry.function_number, page);
+
+			rmi_register_function(data, &entry, page, interrupt);
+			interrupt += entry.interrupt_source_count;
+		}
+
+		if (!page_has_function)
+			break;
+	}
+
+	data->pdt_page_count = page;
+	data->irq_count = interrupt;
+
+	dev_dbg(data->dev, "%s: Done with PDT scan.\n", __func__);
+	retval = 0;
+
+error_exit:
+	return retval;
+}
+
+/*
+ * Let the firmware detect the gestures asked for in fw_gestures, the
+ * others are turned off. Without fw_gestures the firmware defaults are
+ * kept and no gesture is reported.
+ */
+static int rmi_f11_setup_gestures(struct rmi_data *data,
+		struct rmi_f11_sensor *sensor)
+{
+	u8 mask = fw_gestures & sensor->gesture_query[0];
+	int ret;
+
+	sensor->gestures = 0;
+	if (!fw_gestures || !sensor->gesture_query[0])
+		return 0;
+
+	ret = rmi_write(data, data->f11.control_base_addr +
+			sensor->ctrl_offset + RMI_F11_CTRL_GESTURE_EN1, mask);
+	if (ret) {
+		rmi_err(data, "can not enable gestures: %d.\n", ret);
+		return ret;
+	}
+
+	if (mask != (fw_gestures & RMI_F11_GESTURE_MASK))
+		rmi_info(data, "gestures %#04x not supported\n",
+			 (fw_gestures & RMI_F11_GESTURE_MASK) & ~mask);
+
+	sensor->gestures = mask;
+
+	return 0;
+}
+
+/*
+ * Palm rejection in the sensor: palm contacts are dropped before they are
+ * reported, only the palm flag of the gesture data tells about them.
+ */
+static int rmi_f11_setup_palm(struct rmi_data *data,
+		struct rmi_f11_sensor *sensor)
+{
+	/* control 11 follows control 10, if present */
+	u16 en2 = RMI_F11_CTRL_GESTURE_EN1 + !!sensor->gesture_query[0];
+	u16 ctrl_addr = data->f11.control_base_addr + sensor->ctrl_offset;
+	u8 *ctrl = &data->f11.ctrl[sensor->ctrl_offset];
+	u8 value;
+	int ret;
+
+	sensor->palm_detect = false;
+	if (!(sensor->gesture_query[1] & RMI_F11_QUERY8_PALM_DETECT))
+		return 0;
+
+	if (palm_threshold > 0) {
+		value = ctrl[RMI_F11_CTRL_PALM] & ~RMI_F11_CTRL1_PALM_THRESHOLD;
+		value |= min(palm_threshold, RMI_F11_CTRL1_PALM_THRESHOLD);
+		ret = rmi_write(data, ctrl_addr + RMI_F11_CTRL_PALM, value);
+		if (ret)
+			goto error;
+	}
+
+	if (palm_threshold >= 0) {
+		value = ctrl[en2] & ~RMI_F11_GESTURE2_PALM;
+		if (palm_threshold)
+			value |= RMI_F11_GESTURE2_PALM;
+		ret = rmi_write(data, ctrl_addr + en2, value);
+		if (ret)
+			goto error;
+	}
+
+	sensor->palm_detect = !!(ctrl[en2] & RMI_F11_GESTURE2_PALM);
+
+	return 0;
+
+error:
+	rmi_err(data, "can not set up palm detection: %d.\n", ret);
+	return ret;
+}
+
+/*
+ * Parses the query registers of one sensor, starting with its query 1 at
+ * @query_addr, which is moved to the queries of the next sensor. Queries 9,
+ * 11 and 12 are present if flagged in the query 0 of the function (@query0).
+ */
+static int rmi_f11_populate_sensor(struct rmi_data *data,
+		struct rmi_f11_sensor *sensor, u8 query0, u16 *query_addr)
+{
+	u8 buf[4];
+	int ret;
+	bool has_query9 = !!(query0 & BIT(3));
+	bool has_query10;
+	bool has_query11 = !!(query0 & BIT(4));
+	bool has_query12 = !!(query0 & BIT(5));
+	bool has_rel, has_gestures;
+	bool has_physical_props = false;
+	unsigned x_size, y_size;
+	u16 query12_addr;
+
+	/* query 1 to get the max number of fingers */
+	ret = rmi_read(data, *query_addr, buf);
+	if (ret) {
+		rmi_err(data, "can not get NumberOfFingers: %d.\n", ret);
+		return ret;
+	}
+	sensor->max_fingers = (buf[0] & 0x07) + 1;
+	if (sensor->max_fingers > 5)
+		sensor->max_fingers = 10;
+	has_rel = !!(buf[0] & BIT(3));
+	has_gestures = !!(buf[0] & BIT(5));
+
+	sensor->abs_offset = DIV_ROUND_UP(sensor->max_fingers, 4);
+	sensor->report_size = sensor->max_fingers * 5 + sensor->abs_offset;
+	if (has_rel)
+		sensor->report_size += sensor->max_fingers * 2;
+
+	if (!(buf[0] & BIT(4))) {
+		rmi_err(data, "No absolute events, giving up.\n");
+		return -ENODEV;
+	}
+
+	/* query 7 and 8 for the gestures, and to find out if query 10 exists */
+	ret = rmi_read_block(data, *query_addr + 6, buf, 2);
+	if (ret) {
+		rmi_err(data, "can not read gesture information: %d.\n",
+			ret);
+		return ret;
+	}
+	has_query10 = !!(buf[1] & RMI_F11_QUERY8_QUERY10);
+
+	/* the gesture data registers follow the finger data */
+	sensor->gesture_query[0] = has_gestures ? buf[0] : 0;
+	sensor->gesture_query[1] = has_gestures ? buf[1] : 0;
+	sensor->gesture_offset = sensor->report_size;
+	if (sensor->gesture_query[0])
+		sensor->report_size++;
+	if (sensor->gesture_query[0] || sensor->gesture_query[1])
+		sensor->report_size++;
+	if (sensor->gesture_query[0] &
+			(RMI_F11_GESTURE_PINCH | RMI_F11_GESTURE_FLICK) ||
+	    sensor->gesture_query[1] & RMI_F11_QUERY8_ROTATE)
+		sensor->report_size += 2;
+	if (sensor->gesture_query[0] & RMI_F11_GESTURE_FLICK)
+		sensor->report_size++;
+
+	/* At least queries 1 to 8 are guaranteed to be present */
+	query12_addr = *query_addr + 8;
+
+	if (has_query9)
+		++query12_addr;
+
+	if (has_query10)
+		++query12_addr;
+
+	if (has_query11)
+		++query12_addr;
+
+	/* query 12 to know if the physical properties are reported */
+	if (has_query12) {
+		ret = rmi_read(data, query12_addr, buf);
+		if (ret) {
+			rmi_err(data, "can not get query 12: %d.\n", ret);
+			return ret;
+		}
+		has_physical_props = !!(buf[0] & BIT(5));
+
+		if (has_physical_props) {
+			ret = rmi_read_block(data, query12_addr + 1, buf, 4);
+			if (ret) {
+				rmi_err(data,
+					"can not read query 15-18: %d.\n", ret);
+				return ret;
+			}
+
+			x_size = buf[0] | (buf[1] << 8);
+			y_size = buf[2] | (buf[3] << 8);
+
+			sensor->x_size_mm = DIV_ROUND_CLOSEST(x_size, 10);
+			sensor->y_size_mm = DIV_ROUND_CLOSEST(y_size, 10);
+
+			rmi_info(data, "%s: size in mm: %d x %d\n",
+				 __func__, sensor->x_size_mm, sensor->y_size_mm);
+		}
+	}
+
+	*query_addr = query12_addr + has_query12 + (has_physical_props ? 4 : 0);
+
+	/*
+	 * Control 0 to 9, then the gesture enables. Controls 12 and up depend
+	 * on queries which are not parsed here, so they are not counted.
+	 */
+	sensor->ctrl_size = RMI_F11_CTRL_GESTURE_EN1 +
+			    !!sensor->gesture_query[0] +
+			    !!sensor->gesture_query[1];
+
+	return 0;
+}
+
+/*
+ * The query and data registers of the 2D sensors follow each other, in
+ * sensor order. Their offsets are computed once here, the attention path
+ * only adds them up. The control registers follow each other too, but the
+ * size of a control block depends on queries (control 12 and up) this
+ * driver does not parse: only the controls of the first sensor, at the
+ * F11 base, are known to exist. The other sensors are never written, and
+ * their ranges (control 6-9) are unknown: they are parsed to lay out the
+ * frame, but left at 0 so that rmi_sensors_init() does not report them.
+ *
+ * After a reflash the sensors are discovered again in a scratch table, and
+ * only what was discovered is copied back: the input devices and the
+ * contact slots stay.
+ */
+static int rmi_populate_f11(struct rmi_data *data)
+{
+	struct rmi_f11_sensor *found, *sensor;
+	unsigned int report_size = 0;
+	unsigned int count;
+	u16 query_addr;
+	u8 query0;
+	u8 *ctrl;
+	int ret;
+	int i;
+
+	if (!data->f11.query_base_addr) {
+		rmi_err(data, "No 2D sensor found, giving up.\n");
+		return -ENODEV;
+	}
+
+	/* query 0 contains some useful information */
+	ret = rmi_read(data, data->f11.query_base_addr, &query0);
+	if (ret) {
+		rmi_err(data, "can not get query 0: %d.\n", ret);
+		return ret;
+	}
+
+	count = (query0 & 0x07) + 1;
+	if (count > RMI_F11_MAX_SENSORS) {
+		rmi_warn(data, "%u 2D sensors, only %d are handled\n",
+			 count, RMI_F11_MAX_SENSORS);
+		count = RMI_F11_MAX_SENSORS;
+	}
+
+	found = kcalloc(count, sizeof(*found), GFP_KERNEL);
+	if (!found)
+		return -ENOMEM;
+
+	query_addr = data->f11.query_base_addr + 1;
+
+	for (i = 0; i < count; i++) {
+		sensor = &found[i];
+
+		ret = rmi_f11_populate_sensor(data, sensor, query0,
+				&query_addr);
+		if (ret)
+			goto out;
+
+		sensor->data_offset = report_size;
+		report_size += sensor->report_size;
+		if (i)
+			sensor->ctrl_size = 0;
+	}
+
+	if (found[0].ctrl_size > RMI_CTRL_CACHE_SIZE) {
+		rmi_err(data, "F11 control block too large: %u.\n",
+			found[0].ctrl_size);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* retrieve the ctrl registers */
+	ret = rmi_read_block(data, data->f11.control_base_addr,
+			data->f11.ctrl, found[0].ctrl_size);
+	if (ret) {
+		rmi_err(data, "can not read ctrl block of size %u: %d.\n",
+			found[0].ctrl_size, ret);
+		goto out;
+	}
+	data->f11.ctrl_size = found[0].ctrl_size;
+	bitmap_zero(data->f11.ctrl_dirty, RMI_CTRL_CACHE_SIZE);
+
+	ctrl = data->f11.ctrl;
+	sensor = &found[0];
+	sensor->max_x = ctrl[6] | (ctrl[7] << 8);
+	sensor->max_y = ctrl[8] | (ctrl[9] << 8);
+
+	ret = rmi_f11_setup_gestures(data, sensor);
+	if (ret)
+		goto out;
+
+	ret = rmi_f11_setup_palm(data, sensor);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < count; i++) {
+		sensor = &data->sensors[i];
+		found[i].input = sensor->input;
+		found[i].palm = sensor->palm;
+		found[i].motion_x = sensor->motion_x;
+		found[i].motion_y = sensor->motion_y;
+		memcpy(found[i].slots, sensor->slots, sizeof(sensor->slots));
+		*sensor = found[i];
+	}
+
+	data->sensor_count = count;
+	data->f11.report_size = report_size;
+
+out:
+	kfree(found);
+	return ret;
+}
+
+static int rmi_populate_f30(struct rmi_data *data)
+{
+	u8 buf[20];
+	u8 *ctrl;
+	int ret;
+	bool has_gpio, has_led;
+	unsigned bytes_per_ctrl;
+	u8 ctrl2_addr;
+	int ctrl2_3_length;
+	int i;
+
+	/* populated again after a reflash */
+	data->gpio_led_count = 0;
+	data->button_count = 0;
+	data->button_mask = 0;
+	data->button_state_mask = 0;
+
+	/* function F30 is for physical buttons */
+	if (!data->f30.query_base_addr) {
+		rmi_err(data, "No GPIO/LEDs found, giving up.\n");
+		return -ENODEV;
+	}
+
+	ret = rmi_read_block(data, data->f30.query_base_addr, buf, 2);
+	if (ret) {
+		rmi_err(data, "can not get F30 query registers: %d.\n",
+			ret);
+		return ret;
+	}
+
+	has_gpio = !!(buf[0] & BIT(3));
+	has_led = !!(buf[0] & BIT(2));
+	data->gpio_led_count = buf[1] & 0x1f;
+
+	/* retrieve ctrl 2 & 3 registers */
+	bytes_per_ctrl = (data->gpio_led_count + 7) / 8;
+	/* Ctrl0 is present only if both has_gpio and has_led are set*/
+	ctrl2_addr = (has_gpio && has_led) ? bytes_per_ctrl : 0;
+	/* Ctrl1 is always be present */
+	ctrl2_addr += bytes_per_ctrl;
+	ctrl2_3_length = 2 * bytes_per_ctrl;
+
+	data->f30.report_size = bytes_per_ctrl;
+
+	/* ctrl 0 to 3 are kept in the register cache */
+	ret = rmi_read_block(data, data->f30.control_base_addr,
+				data->f30.ctrl, ctrl2_addr + ctrl2_3_length);
+	if (ret) {
+		rmi_err(data,
+			"can not read ctrl 2&3 block of size %d: %d.\n",
+			ctrl2_3_length, ret);
+		return ret;
+	}
+	data->f30.ctrl_size = ctrl2_addr + ctrl2_3_length;
+	bitmap_zero(data->f30.ctrl_dirty, RMI_CTRL_CACHE_SIZE);
+	ctrl = &data->f30.ctrl[ctrl2_addr];
+
+	for (i = 0; i < data->gpio_led_count; i++) {
+		int byte_position = i >> 3;
+		int bit_position = i & 0x07;
+		u8 dir_byte = ctrl[byte_position];
+		u8 data_byte = ctrl[byte_position + bytes_per_ctrl];
+		bool dir = (dir_byte >> bit_position) & BIT(0);
+		bool dat = (data_byte >> bit_position) & BIT(0);
+
+		if (dir == 0) {
+			/* input mode */
+			if (dat) {
+				/* actual buttons have pull up resistor */
+				data->button_count++;
+				set_bit(i, &data->button_mask);
+				set_bit(i, &data->button_state_mask);
+			}
+		}
+
+	}
+
+	return 0;
+}
+
+static int rmi_populate_f01(struct rmi_data *data)
+{
+	int size;
+	int ret;
+
+	if (!data->f01.query_base_addr)
+		return 0;
+
+	/* device control, then the interrupt enable registers */
+	size = 1 + DIV_ROUND_UP(data->irq_count, 8);
+	if (size > RMI_CTRL_CACHE_SIZE)
+		size = RMI_CTRL_CACHE_SIZE;
+
+	ret = rmi_read_block(data, data->f01.control_base_addr,
+			data->f01.ctrl, size);
+	if (ret) {
+		rmi_err(data, "can not read F01 control: %d.\n", ret);
+		return ret;
+	}
+	data->f01.ctrl_size = size;
+	bitmap_zero(data->f01.ctrl_dirty, RMI_CTRL_CACHE_SIZE);
+
+	return 0;
+}
+
+static int rmi_populate(struct rmi_data *data)
+{
+	int ret;
+
+	ret = rmi_scan_pdt(data);
+	if (ret) {
+		rmi_err(data, "PDT scan failed with code %d.\n", ret);
+		return ret;
+	}
+
+	ret = rmi_populate_f01(data);
+	if (ret) {
+		rmi_err(data, "Error while initializing F01 (%d).\n", ret);
+		return ret;
+	}
+
+	ret = rmi_populate_f11(data);
+	if (ret) {
+		rmi_err(data, "Error while initializing F11 (%d).\n", ret);
+		return ret;
+	}
+
+	ret = rmi_populate_f30(data);
+	if (ret)
+		rmi_warn(data, "Error while initializing F30 (%d).\n",
+			ret);
+
+	return 0;
+}
+
+/**
+ * rmi_fetch_attn_frame - Build an attention frame from the data registers
+ * @data: The pointer to the rmi_data struct
+ * @irq: interrupt status the frame is built for
+ * @frame: destination, at least rmi_attn_frame_size() bytes
+ * @size: size of @frame
+ * @span: registers already read from @span_base, or NULL
+ * @span_base: address of the first byte of @span
+ * @span_len: length of @span
+ *
+ * Reads the data registers of every function flagged in @irq, in interrupt
+ * order, so that the result can be fed to rmi_input_event() exactly like
+ * an RMI_ATTN_REPORT_ID report. Blocks inside @span are copied from it
+ * instead of being read again.
+ *
+ * Returns the length of the frame on success, a negative error otherwise.
+ */
+static int rmi_fetch_attn_frame(struct rmi_data *data, u8 irq, u8 *frame,
+		int size, const u8 *span, u16 span_base, int span_len)
+{
+	struct rmi_function *order[2];
+	struct rmi_function *f;
+	int index = 2;
+	int ret;
+	int i;
+
+	if (data->f11.interrupt_base < data->f30.interrupt_base) {
+		order[0] = &data->f11;
+		order[1] = &data->f30;
+	} else {
+		order[0] = &data->f30;
+		order[1] = &data->f11;
+	}
+
+	frame[0] = RMI_ATTN_REPORT_ID;
+	frame[1] = irq;
+
+	for (i = 0; i < ARRAY_SIZE(order); i++) {
+		f = order[i];
+		if (!(irq & f->irq_mask) || !f->report_size)
+			continue;
+
+		if (index + f->report_size > size)
+			return -EOVERFLOW;
+
+		if (span && f->data_base_addr >= span_base &&
+		    f->data_base_addr + f->report_size <= span_base + span_len) {
+			memcpy(&frame[index], &span[f->data_base_addr - span_base],
+			       f->report_size);
+		} else {
+			ret = rmi_read_block(data, f->data_base_addr,
+					&frame[index], f->report_size);
+			if (ret)
+				return ret;
+		}
+
+		index += f->report_size;
+	}
+
+	return index;
+}
+
+/*
+ * Polling mode. Some units stop asserting attention while still answering
+ * register reads. A tick then reads the interrupt status and the F11/F30
+ * data with a single block read and feeds the regular decode path.
+ *
+ * With poll_mode=1, a watchdog samples the attention frame counter every
+ * poll_silence_ms. Only after a whole period without a single frame does
+ * it read the interrupt status, which is clear-on-read: pending data means
+ * the reports were lost, and the device is polled until attention comes
+ * back or nothing moved for poll_silence_ms. A frame arriving meanwhile
+ * means the attention path is alive and delivers the same data, so the
+ * read is then not decoded.
+ */
+static void rmi_poll_enter(struct rmi_data *data)
+{
+	struct rmi_poll *poll = &data->poll;
+	u64 now = ktime_get_ns();
+
+	rmi_poll_account(poll, now);
+	poll->last_data_ns = now;
+	WRITE_ONCE(poll->active, true);
+	hrtimer_start(&poll->timer, ns_to_ktime(poll_interval_us * NSEC_PER_USEC),
+		      HRTIMER_MODE_REL);
+}
+
+/*
+ * Reads the sensor once. With @attn, the frame is dropped if attention
+ * frames arrived since the counter was sampled. Returns 1 if a frame was
+ * decoded, 0 if nothing was pending, a negative error otherwise.
+ */
+static int rmi_poll_once(struct rmi_data *data, u64 *bytes, const u64 *attn)
+{
+	struct rmi_poll *poll = &data->poll;
+	unsigned long flags;
+	u8 status;
+	int len = 0;
+	int ret;
+
+	if (poll->span_len) {
+		ret = rmi_read_block(data, poll->span_base, poll->span,
+				poll->span_len);
+		status = poll->span[poll->status_addr - poll->span_base];
+		*bytes += poll->span_len;
+	} else {
+		ret = rmi_read(data, poll->status_addr, &status);
+		*bytes += 1;
+	}
+	if (ret)
+		return ret;
+
+	if (!(status & (data->f11.irq_mask | data->f30.irq_mask)))
+		return 0;
+
+	len = rmi_fetch_attn_frame(data, status, poll->frame,
+			rmi_attn_frame_size(data),
+			poll->span_len ? poll->span : NULL,
+			poll->span_base, poll->span_len);
+	if (len <= 0)
+		return len;
+
+	spin_lock_irqsave(&poll->lock, flags);
+	if (attn && READ_ONCE(poll->stats.attn_frames) != *attn) {
+		spin_unlock_irqrestore(&poll->lock, flags);
+		return 0;
+	}
+	rmi_input_event(data, poll->frame, len);
+	spin_unlock_irqrestore(&poll->lock, flags);
+
+	poll->last_data_ns = ktime_get_ns();
+	return 1;
+}
+
+static void rmi_poll_work(struct work_struct *work)
+{
+	struct rmi_data *data = container_of(work, struct rmi_data,
+					     poll.work);
+	struct rmi_poll *poll = &data->poll;
+	u64 start = ktime_get_ns();
+	int ret;
+
+	if (!READ_ONCE(poll->active))
+		return;
+
+	ret = rmi_poll_once(data, &poll->stats.bytes, NULL);
+	poll->stats.ticks++;
+	poll->stats.bus_ns += ktime_get_ns() - start;
+	if (ret > 0)
+		poll->stats.frames++;
+
+	if (poll_mode == RMI_POLL_AUTO && ret <= 0 &&
+	    start - poll->last_data_ns > poll_silence_ms * NSEC_PER_MSEC) {
+		poll->stats.to_attn++;
+		rmi_poll_leave(data);
+	}
+}
+
+static enum hrtimer_restart rmi_poll_timer(struct hrtimer *timer)
+{
+	struct rmi_poll *poll = container_of(timer, struct rmi_poll, timer);
+
+	if (!READ_ONCE(poll->active))
+		return HRTIMER_NORESTART;
+
+	queue_work(system_highpri_wq, &poll->work);
+	hrtimer_forward_now(timer, ns_to_ktime(poll_interval_us * NSEC_PER_USEC));
+	return HRTIMER_RESTART;
+}
+
+static void rmi_poll_watch(struct work_struct *work)
+{
+	struct rmi_data *data = container_of(to_delayed_work(work),
+					     struct rmi_data, poll.watch);
+	struct rmi_poll *poll = &data->poll;
+	u64 attn = READ_ONCE(poll->stats.attn_frames);
+
+	if (!READ_ONCE(poll->active) && attn == poll->watch_attn) {
+		poll->stats.watch_reads++;
+		if (rmi_poll_once(data, &poll->stats.watch_bytes, &attn) > 0) {
+			dev_warn(data->dev,
+				 "attention reports lost, polling every %u us\n",
+				 poll_interval_us);
+			poll->stats.to_poll++;
+			rmi_poll_enter(data);
+		}
+	}
+
+	poll->watch_attn = READ_ONCE(poll->stats.attn_frames);
+	queue_delayed_work(rmi_wq, &poll->watch,
+			   msecs_to_jiffies(poll_silence_ms));
+}
+
+static void rmi_poll_arm(struct rmi_data *data)
+{
+	struct rmi_poll *poll = &data->poll;
+
+	if (!poll->enabled)
+		return;
+
+	poll->since_ns = ktime_get_ns();
+	poll->watch_attn = READ_ONCE(poll->stats.attn_frames);
+	if (poll_mode == RMI_POLL_ALWAYS)
+		rmi_poll_enter(data);
+	else
+		queue_delayed_work(rmi_wq, &poll->watch,
+				   msecs_to_jiffies(poll_silence_ms));
+}
+
+static void rmi_poll_halt(struct rmi_data *data)
+{
+	struct rmi_poll *poll = &data->poll;
+
+	if (!poll->enabled)
+		return;
+
+	cancel_delayed_work_sync(&poll->watch);
+	rmi_poll_leave(data);
+	hrtimer_cancel(&poll->timer);
+	cancel_work_sync(&poll->work);
+	poll->since_ns = 0;
+}
+
+/*
+ * The interrupt status and the data blocks are usually a few bytes apart
+ * on page 0, a single read covers them all. Also run after a reflash with
+ * the works stopped, the frame size is the same then.
+ */
+static void rmi_poll_layout(struct rmi_data *data)
+{
+	struct rmi_function *fns[] = { &data->f11, &data->f30 };
+	struct rmi_poll *poll = &data->poll;
+	u16 lo, hi;
+	int i;
+
+	poll->enabled = false;
+	poll->span_base = 0;
+	poll->span_len = 0;
+
+	if (poll_mode == RMI_POLL_OFF || !data->f01.query_base_addr)
+		return;
+
+	if (!poll->frame)
+		poll->frame = devm_kzalloc(data->dev,
+				rmi_attn_frame_size(data), GFP_KERNEL);
+	if (!poll->span)
+		poll->span = devm_kzalloc(data->dev, RMI_POLL_MAX_SPAN,
+				GFP_KERNEL);
+	if (!poll->frame || !poll->span)
+		return;
+
+	poll->status_addr = data->f01.data_base_addr + 1;
+	lo = poll->status_addr;
+	hi = lo + 1;
+	for (i = 0; i < ARRAY_SIZE(fns); i++) {
+		if (!fns[i]->report_size)
+			continue;
+		lo = min_t(u16, lo, fns[i]->data_base_addr);
+		hi = max_t(u16, hi, fns[i]->data_base_addr +
+				    fns[i]->report_size);
+	}
+
+	if (RMI_PAGE(lo) == RMI_PAGE(hi - 1) && hi - lo <= RMI_POLL_MAX_SPAN) {
+		poll->span_base = lo;
+		poll->span_len = hi - lo;
+	}
+
+	poll->enabled = true;
+}
+
+static void rmi_poll_init(struct rmi_data *data)
+{
+	struct rmi_poll *poll = &data->poll;
+
+	INIT_WORK(&poll->work, rmi_poll_work);
+	INIT_DELAYED_WORK(&poll->watch, rmi_poll_watch);
+	hrtimer_setup(&poll->timer, rmi_poll_timer, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL);
+
+	rmi_poll_layout(data);
+}
+
+static void rmi_setup_sensor(struct rmi_f11_sensor *sensor,
+		struct input_dev *input)
+{
+	int res_x, res_y;
+
+	__set_bit(EV_ABS, input->evbit);
+	input_set_abs_params(input, ABS_MT_POSITION_X, 1, sensor->max_x, 0, 0);
+	input_set_abs_params(input, ABS_MT_POSITION_Y, 1, sensor->max_y, 0, 0);
+
+	if (sensor->x_size_mm && sensor->y_size_mm) {
+		res_x = (sensor->max_x - 1) / sensor->x_size_mm;
+		res_y = (sensor->max_y - 1) / sensor->y_size_mm;
+
+		input_abs_set_res(input, ABS_MT_POSITION_X, res_x);
+		input_abs_set_res(input, ABS_MT_POSITION_Y, res_y);
+	}
+
+	input_set_abs_params(input, ABS_MT_ORIENTATION, 0, 1, 0, 0);
+	input_set_abs_params(input, ABS_MT_PRESSURE, 0, 0xff, 0, 0);
+	input_set_abs_params(input, ABS_MT_TOUCH_MAJOR, 0, 0x0f, 0, 0);
+	input_set_abs_params(input, ABS_MT_TOUCH_MINOR, 0, 0x0f, 0, 0);
+
+	input_mt_init_slots(input, sensor->max_fingers, INPUT_MT_POINTER);
+
+	if (sensor->gestures) {
+		__set_bit(EV_MSC, input->evbit);
+		__set_bit(MSC_GESTURE, input->mscbit);
+	}
+
+	sensor->input = input;
+}
+
+/* the main input device: the first 2D sensor and the buttons */
+static void rmi_setup_input(struct rmi_data *data, struct input_dev *input)
+{
+	int i;
+
+	rmi_setup_sensor(&data->sensors[0], input);
+
+	if (data->button_count) {
+		__set_bit(EV_KEY, input->evbit);
+		for (i = 0; i < data->button_count; i++)
+			__set_bit(BTN_LEFT + i, input->keybit);
+
+		if (data->button_count == 1)
+			__set_bit(INPUT_PROP_BUTTONPAD, input->propbit);
+	}
+}
+
+/*
+ * The sensor only streams while one of its input devices is open: the first
+ * open powers the transport up and wakes the sensor, the last close puts it
+ * back to sleep and lets the transport autosuspend.
+ */
+static int rmi_open(struct rmi_data *data)
+{
+	u64 start = ktime_get_ns();
+	u64 elapsed;
+	int ret = 0;
+
+	mutex_lock(&data->open_mutex);
+	if (data->open_count++)
+		goto out;
+
+	ret = rmi_transport_get(data);
+	if (ret)
+		goto err_count;
+
+	ret = rmi_set_mode(data, RMI_MODE_ATTN_REPORTS);
+	if (ret)
+		goto err;
+
+	ret = rmi_f01_set_sleep(data, RMI_F01_CTRL0_SLEEP_NORMAL);
+	if (ret)
+		goto err;
+
+	set_bit(RMI_OPENED, &data->flags);
+	rmi_workers_start(data);
+
+	elapsed = ktime_get_ns() - start;
+	data->pm_stats.opens++;
+	data->pm_stats.open_last_ns = elapsed;
+	if (elapsed > data->pm_stats.open_max_ns)
+		data->pm_stats.open_max_ns = elapsed;
+	if (elapsed > (u64)open_budget_ms * NSEC_PER_MSEC) {
+		data->pm_stats.open_over_budget++;
+		dev_warn(data->dev, "wake-up took %llu us, budget is %u ms\n",
+			 div_u64(elapsed, NSEC_PER_USEC), open_budget_ms);
+	}
+	goto out;
+
+err:
+	rmi_transport_put(data);
+err_count:
+	data->open_count--;
+out:
+	mutex_unlock(&data->open_mutex);
+	return ret;
+}
+
+static void rmi_close(struct rmi_data *data)
+{
+	mutex_lock(&data->open_mutex);
+	if (!--data->open_count) {
+		clear_bit(RMI_OPENED, &data->flags);
+		rmi_workers_stop(data);
+		rmi_f01_set_sleep(data, RMI_F01_CTRL0_SLEEP_SENSOR);
+		rmi_transport_put(data);
+	}
+	mutex_unlock(&data->open_mutex);
+}
+
+/* the other sensors and the scroll device, drvdata is the rmi_data */
+static int rmi_sub_input_open(struct input_dev *input)
+{
+	return rmi_open(input_get_drvdata(input));
+}
+
+static void rmi_sub_input_close(struct input_dev *input)
+{
+	rmi_close(input_get_drvdata(input));
+}
+
+static int rmi_scroll_input_open(struct input_dev *input)
+{
+	struct rmi_data *data = input_get_drvdata(input);
+	int ret;
+
+	ret = rmi_open(data);
+	if (!ret)
+		WRITE_ONCE(data->scroll.open, true);
+	return ret;
+}
+
+static void rmi_scroll_input_close(struct input_dev *input)
+{
+	struct rmi_data *data = input_get_drvdata(input);
+
+	WRITE_ONCE(data->scroll.open, false);
+	rmi_close(data);
+}
+
+/*
+ * The other 2D sensors of a composite device get an input device each,
+ * opening any of them wakes the sensor like the main device does. A
+ * sensor with unknown ranges gets none, rather than one reporting
+ * misscaled coordinates.
+ */
+static int rmi_sensors_init(struct rmi_data *data, const char *name)
+{
+	struct rmi_f11_sensor *sensor;
+	struct input_dev *input;
+	int skipped = 0;
+	int ret;
+	int i;
+
+	for (i = 1; i < data->sensor_count; i++) {
+		sensor = &data->sensors[i];
+		if (!sensor->max_x || !sensor->max_y) {
+			skipped++;
+			continue;
+		}
+
+		input = devm_input_allocate_device(data->dev);
+		if (!input)
+			return -ENOMEM;
+
+		input->name = devm_kasprintf(data->dev, GFP_KERNEL,
+					     "%s Sensor %d", name, i);
+		input->id = data->input->id;
+		input->open = rmi_sub_input_open;
+		input->close = rmi_sub_input_close;
+		input_set_drvdata(input, data);
+		rmi_setup_sensor(sensor, input);
+
+		ret = input_register_device(input);
+		if (ret) {
+			sensor->input = NULL;
+			return ret;
+		}
+	}
+
+	if (skipped)
+		dev_warn(data->dev,
+			 "%d more 2D sensors with unknown ranges, not reported\n",
+			 skipped);
+
+	return 0;
+}
+
+/*
+ * Registers the secondary scroll device when the offload is enabled. The
+ * scroll thresholds are in mm, so they are scaled by the physical size of
+ * the sensor (query 15-18) when it is known.
+ */
+static int rmi_scroll_init(struct rmi_data *data, const char *name)
+{
+	struct rmi_f11_sensor *sensor = &data->sensors[0];
+	struct rmi_scroll *scroll = &data->scroll;
+	struct input_dev *input;
+	int ret;
+
+	if (!scroll_offload)
+		return 0;
+
+	input = devm_input_allocate_device(data->dev);
+	if (!input)
+		return -ENOMEM;
+
+	input->name = devm_kasprintf(data->dev, GFP_KERNEL, "%s Scroll", name);
+	input->id = data->input->id;
+	input->open = rmi_scroll_input_open;
+	input->close = rmi_scroll_input_close;
+	input_set_drvdata(input, data);
+	input_set_capability(input, EV_REL, REL_WHEEL);
+	input_set_capability(input, EV_REL, REL_HWHEEL);
+	input_set_capability(input, EV_REL, REL_WHEEL_HI_RES);
+	input_set_capability(input, EV_REL, REL_HWHEEL_HI_RES);
+
+	if (sensor->x_size_mm && sensor->y_size_mm) {
+		scroll->units_x = sensor->max_x / sensor->x_size_mm;
+		scroll->units_y = sensor->max_y / sensor->y_size_mm;
+	} else {
+		scroll->units_x = sensor->max_x / RMI_SCROLL_FALLBACK_SIZE_MM;
+		scroll->units_y = sensor->max_y / RMI_SCROLL_FALLBACK_SIZE_MM;
+	}
+	scroll->units_x = max(scroll->units_x, 1);
+	scroll->units_y = max(scroll->units_y, 1);
+
+	ret = input_register_device(input);
+	if (ret)
+		return ret;
+
+	scroll->input = input;
+	return 0;
+}
+
+/*
+ * The full rate is what the firmware programmed. The lowered rate is the
+ * reduced reporting mode with the delta thresholds of the firmware, raised
+ * to RMI_RATE_SLOW_DELTA_MM if they are smaller. Contacts moving by less
+ * than RMI_RATE_SLOW_DELTA_MM do not count as motion either. Run again
+ * after a reflash, with the works stopped.
+ */
+static void rmi_rate_layout(struct rmi_data *data)
+{
+	struct rmi_f11_sensor *sensor;
+	struct rmi_rate *rate = &data->rate;
+	unsigned int units_x, units_y;
+	u8 *ctrl = data->f11.ctrl;
+	int i;
+
+	rate->enabled = false;
+
+	if (!adaptive_rate || data->f11.ctrl_size <= RMI_F11_CTRL_DELTA_Y)
+		return;
+
+	for (i = 0; i < data->sensor_count; i++) {
+		sensor = &data->sensors[i];
+		if (sensor->x_size_mm && sensor->y_size_mm) {
+			units_x = sensor->max_x / sensor->x_size_mm;
+			units_y = sensor->max_y / sensor->y_size_mm;
+		} else {
+			units_x = sensor->max_x / RMI_SCROLL_FALLBACK_SIZE_MM;
+			units_y = sensor->max_y / RMI_SCROLL_FALLBACK_SIZE_MM;
+		}
+		sensor->motion_x = units_x * RMI_RATE_SLOW_DELTA_MM;
+		sensor->motion_y = units_y * RMI_RATE_SLOW_DELTA_MM;
+	}
+
+	sensor = &data->sensors[0];
+	rate->report_mode[RMI_RATE_FAST] = ctrl[RMI_F11_CTRL_REPORT_MODE] &
+					   RMI_F11_CTRL0_REPORT_MODE_MASK;
+	rate->report_mode[RMI_RATE_SLOW] = RMI_F11_CTRL0_REPORT_REDUCED;
+	rate->delta[RMI_RATE_FAST][0] = ctrl[RMI_F11_CTRL_DELTA_X];
+	rate->delta[RMI_RATE_FAST][1] = ctrl[RMI_F11_CTRL_DELTA_Y];
+	rate->delta[RMI_RATE_SLOW][0] = clamp_t(unsigned int, sensor->motion_x,
+			ctrl[RMI_F11_CTRL_DELTA_X], 0xff);
+	rate->delta[RMI_RATE_SLOW][1] = clamp_t(unsigned int, sensor->motion_y,
+			ctrl[RMI_F11_CTRL_DELTA_Y], 0xff);
+
+	rate->mode = RMI_RATE_FAST;
+	rate->since_ns = ktime_get_ns();
+	rate->enabled = true;
+}
+
+static void rmi_rate_init(struct rmi_data *data)
+{
+	INIT_DELAYED_WORK(&data->rate.work, rmi_rate_work);
+	rmi_rate_layout(data);
+}
+
+static int rmi_hid_input_open(struct input_dev *input)
+{
+	struct hid_device *hdev = input_get_drvdata(input);
+
+	return rmi_open(hid_get_drvdata(hdev));
+}
+
+static void rmi_hid_input_close(struct input_dev *input)
+{
+	struct hid_device *hdev = input_get_drvdata(input);
+
+	rmi_close(hid_get_drvdata(hdev));
+}
+
+static void rmi_input_configured(struct hid_device *hdev, struct hid_input *hi)
+{
+	struct rmi_data *data = hid_get_drvdata(hdev);
+	struct input_dev *input = hi->input;
+	int ret;
+	u64 start;
+
+	data->input = input;
+
+	hid_info(hdev, "Opening low level driver\n");
+	ret = hid_hw_open(hdev);
+	if (ret)
+		return;
+
+	/* Allow incoming hid reports */
+	hid_device_io_start(hdev);
+
+	ret = rmi_set_mode(data, RMI_MODE_ATTN_REPORTS);
+	if (ret < 0) {
+		dev_err(&hdev->dev, "failed to set rmi mode\n");
+		goto exit;
+	}
+
+	ret = rmi_set_page(data, 0);
+	if (ret < 0) {
+		dev_err(&hdev->dev, "failed to set page select to 0.\n");
+		goto exit;
+	}
+
+	start = ktime_get_ns();
+	ret = rmi_populate(data);
+	if (ret)
+		goto exit;
+	data->populate_ns = ktime_get_ns() - start;
+
+	data->attn_frame = devm_kzalloc(&hdev->dev, rmi_attn_frame_size(data),
+			GFP_KERNEL);
+	if (!data->attn_frame)
+		goto exit;
+
+	rmi_ring_init(data);
+
+	rmi_setup_input(data, input);
+	input->open = rmi_hid_input_open;
+	input->close = rmi_hid_input_close;
+
+	ret = rmi_sensors_init(data, hdev->name);
+	if (ret)
+		hid_warn(hdev, "can not register the sensor devices: %d\n",
+			 ret);
+
+	ret = rmi_scroll_init(data, hdev->name);
+	if (ret)
+		hid_warn(hdev, "can not register the scroll device: %d\n", ret);
+
+	rmi_rate_init(data);
+	rmi_poll_init(data);
+
+	/* nobody listens yet */
+	rmi_f01_set_sleep(data, RMI_F01_CTRL0_SLEEP_SENSOR);
+
+	hid_info(hdev, "Got data about trackpad: %i buttons, supports %i fingers.", data->button_count, data->sensors[0].max_fingers);
+
+	set_bit(RMI_STARTED, &data->flags);
+
+exit:
+	hid_device_io_stop(hdev);
+	hid_hw_close(hdev);
+}
+
+static int rmi_input_mapping(struct hid_device *hdev,
+		struct hid_input *hi, struct hid_field *field,
+		struct hid_usage *usage, unsigned long **bit, int *max)
+{
+	/* we want to make HID ignore the advertised HID collection */
+	return -1;
+}
+
+/*
+ * F34 reflash (version 0 register map). The command/status register
+ * follows the block data, so a block and its write command go out in a
+ * single block write, and completion is polled right away: the round
+ * trip of the status read usually covers the programming time.
+ */
+
+#define RMI_F34_BLOCK_DATA_OFFSET	2
+
+#define RMI_F34_WRITE_FW_BLOCK		0x02
+#define RMI_F34_ERASE_ALL		0x03
+#define RMI_F34_READ_CONFIG_BLOCK	0x05
+#define RMI_F34_WRITE_CONFIG_BLOCK	0x06
+#define RMI_F34_ENABLE_FLASH_PROG	0x0f
+
+#define RMI_F34_COMMAND_MASK		0x0f
+#define RMI_F34_STATUS_MASK		0x70
+#define RMI_F34_PROGRAM_ENABLED		BIT(7)
+
+#define RMI_F34_IDLE_WAIT_MS		500
+#define RMI_F34_ENABLE_WAIT_MS		300
+#define RMI_F34_ERASE_WAIT_MS		5000
+
+/* Synaptics .img layout, the firmware then the configuration follow */
+struct rmi_f34_image {
+	__le32 checksum;
+	u8 pad1[3];
+	u8 bootloader_version;
+	__le32 image_size;
+	__le32 config_size;
+	u8 product_id[10];
+	u8 product_info[2];
+	u8 pad2[228];
+	u8 data[];
+} __packed;
+
+static inline u16 rmi_f34_status_addr(struct rmi_data *data)
+{
+	return data->f34.data_base_addr + RMI_F34_BLOCK_DATA_OFFSET +
+		data->flash.block_size;
+}
+
+static int rmi_f34_wait_idle(struct rmi_data *data, unsigned int timeout_ms,
+		u8 *status)
+{
+	unsigned long timeout = jiffies + msecs_to_jiffies(timeout_ms);
+	int ret;
+
+	for (;;) {
+		ret = rmi_read(data, rmi_f34_status_addr(data), status);
+		if (ret)
+			return ret;
+		data->flash.polls++;
+
+		if (!(*status & RMI_F34_COMMAND_MASK))
+			break;
+
+		if (time_after(jiffies, timeout))
+			return -ETIMEDOUT;
+
+		usleep_range(100, 200);
+	}
+
+	if (*status & RMI_F34_STATUS_MASK) {
+		dev_err(data->dev, "flash command failed, status %#04x\n",
+			*status);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int rmi_f34_command(struct rmi_data *data, u8 command,
+		unsigned int timeout_ms)
+{
+	u8 status;
+	int ret;
+
+	/* the erase and enable commands must be unlocked */
+	ret = rmi_write_block(data,
+			data->f34.data_base_addr + RMI_F34_BLOCK_DATA_OFFSET,
+			data->flash.bootloader_id,
+			sizeof(data->flash.bootloader_id));
+	if (ret)
+		return ret;
+
+	ret = rmi_write(data, rmi_f34_status_addr(data), command);
+	if (ret)
+		return ret;
+
+	ret = rmi_f34_wait_idle(data, timeout_ms, &status);
+	if (ret)
+		return ret;
+
+	if (command == RMI_F34_ENABLE_FLASH_PROG &&
+	    !(status & RMI_F34_PROGRAM_ENABLED))
+		return -EIO;
+
+	return 0;
+}
+
+static int rmi_f34_write_blocks(struct rmi_data *data, const u8 *src,
+		int count, u8 command)
+{
+	u16 size = data->flash.block_size;
+	__le16 block = cpu_to_le16(0);
+	u8 status;
+	u8 *buf;
+	int ret;
+	int i;
+
+	buf = kmalloc(size + 1, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	/* the block number then increments on every command */
+	ret = rmi_write_block(data, data->f34.data_base_addr, &block,
+			sizeof(block));
+	if (ret)
+		goto out;
+
+	buf[size] = command;
+	for (i = 0; i < count; i++) {
+		memcpy(buf, src + i * size, size);
+		ret = rmi_write_block(data, data->f34.data_base_addr +
+				RMI_F34_BLOCK_DATA_OFFSET, buf, size + 1);
+		if (ret)
+			break;
+
+		ret = rmi_f34_wait_idle(data, RMI_F34_IDLE_WAIT_MS, &status);
+		if (ret) {
+			dev_err(data->dev, "can not write block %d: %d\n",
+				i, ret);
+			break;
+		}
+	}
+
+out:
+	kfree(buf);
+	return ret;
+}
+
+/* read back the configuration area, one block read per flash block */
+static int rmi_f34_verify_config(struct rmi_data *data, const u8 *src)
+{
+	u16 size = data->flash.block_size;
+	__le16 block = cpu_to_le16(0);
+	u8 status;
+	u8 *buf;
+	int ret;
+	int i;
+
+	buf = kmalloc(size, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = rmi_write_block(data, data->f34.data_base_addr, &block,
+			sizeof(block));
+	if (ret)
+		goto out;
+
+	for (i = 0; i < data->flash.cfg_blocks; i++) {
+		ret = rmi_write(data, rmi_f34_status_addr(data),
+				RMI_F34_READ_CONFIG_BLOCK);
+		if (ret)
+			break;
+
+		ret = rmi_f34_wait_idle(data, RMI_F34_IDLE_WAIT_MS, &status);
+		if (ret)
+			break;
+
+		ret = rmi_read_block(data, data->f34.data_base_addr +
+				RMI_F34_BLOCK_DATA_OFFSET, buf, size);
+		if (ret)
+			break;
+
+		if (memcmp(buf, src + i * size, size)) {
+			dev_err(data->dev, "config block %d differs\n", i);
+			ret = -EIO;
+			break;
+		}
+	}
+
+out:
+	kfree(buf);
+	return ret;
+}
+
+static int rmi_f34_read_geometry(struct rmi_data *data)
+{
+	struct rmi_flash *flash = &data->flash;
+	u8 buf[9];
+	int ret;
+
+	if (!data->f34.query_base_addr)
+		return -ENODEV;
+
+	/* bootloader id, properties, block size, block counts */
+	ret = rmi_read_block(data, data->f34.query_base_addr, buf,
+			sizeof(buf));
+	if (ret)
+		return ret;
+
+	flash->bootloader_id[0] = buf[0];
+	flash->bootloader_id[1] = buf[1];
+	flash->block_size = buf[3] | (buf[4] << 8);
+	flash->fw_blocks = buf[5] | (buf[6] << 8);
+	flash->cfg_blocks = buf[7] | (buf[8] << 8);
+
+	if (!flash->block_size)
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * After the update the firmware restarts from scratch: the reporting
+ * mode, the page and every register address may have changed.
+ */
+static int rmi_f34_restart(struct rmi_data *data)
+{
+	unsigned int sensors = data->sensor_count;
+	int frame_size = rmi_attn_frame_size(data);
+	u8 status;
+	int ret;
+
+	ret = rmi_write(data, data->f01.command_base_addr, RMI_F01_CMD_RESET);
+	if (ret)
+		return ret;
+
+	msleep(RMI_F01_RESET_DELAY_MS);
+
+	ret = rmi_xfer_page_reset(data);
+	if (ret)
+		return ret;
+
+	ret = rmi_set_mode(data, RMI_MODE_ATTN_REPORTS);
+	if (ret)
+		return ret;
+
+	ret = rmi_read(data, data->f01.data_base_addr, &status);
+	if (ret)
+		return ret;
+
+	if (status & (RMI_F01_STATUS_BOOTLOADER | RMI_F01_STATUS_CODE_MASK)) {
+		dev_err(data->dev, "firmware did not start, status %#04x\n",
+			status);
+		return -EIO;
+	}
+
+	ret = rmi_populate(data);
+	if (ret)
+		return ret;
+
+	if (data->sensor_count != sensors ||
+	    rmi_attn_frame_size(data) != frame_size) {
+		dev_warn(data->dev,
+			 "report layout changed, rebind the device\n");
+		return -EAGAIN;
+	}
+
+	/* thresholds, units and register spans of the new firmware */
+	rmi_rate_layout(data);
+	rmi_poll_layout(data);
+
+	return rmi_f01_set_sleep(data, test_bit(RMI_OPENED, &data->flags) ?
+			RMI_F01_CTRL0_SLEEP_NORMAL :
+			RMI_F01_CTRL0_SLEEP_SENSOR);
+}
+
+static int rmi_f34_flash(struct rmi_data *data, const struct firmware *fw)
+{
+	const struct rmi_f34_image *image = (const void *)fw->data;
+	struct rmi_flash *flash = &data->flash;
+	u32 image_size, config_size;
+	u64 start = ktime_get_ns();
+	int restart_ret;
+	u64 t;
+	int ret;
+
+	if (fw->size < sizeof(*image))
+		return -EINVAL;
+
+	ret = rmi_transport_get(data);
+	if (ret)
+		return ret;
+
+	ret = rmi_f34_read_geometry(data);
+	if (ret) {
+		dev_err(data->dev, "no usable F34: %d\n", ret);
+		goto out;
+	}
+
+	image_size = le32_to_cpu(image->image_size);
+	config_size = le32_to_cpu(image->config_size);
+	if (image_size != flash->fw_blocks * flash->block_size ||
+	    config_size != flash->cfg_blocks * flash->block_size ||
+	    fw->size < sizeof(*image) + image_size + config_size) {
+		dev_err(data->dev, "image does not match the flash layout\n");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	dev_info(data->dev, "flashing %.*s, %u + %u blocks of %u bytes\n",
+		 (int)sizeof(image->product_id), image->product_id,
+		 flash->fw_blocks, flash->cfg_blocks, flash->block_size);
+
+	/* the decode path must not see the bootloader */
+	clear_bit(RMI_STARTED, &data->flags);
+	rmi_workers_stop(data);
+	flash->polls = 0;
+
+	t = ktime_get_ns();
+	ret = rmi_f34_command(data, RMI_F34_ENABLE_FLASH_PROG,
+			RMI_F34_ENABLE_WAIT_MS);
+	flash->enable_ns = ktime_get_ns() - t;
+	if (ret) {
+		dev_err(data->dev, "can not enter the bootloader: %d\n", ret);
+		goto restart;
+	}
+
+	t = ktime_get_ns();
+	ret = rmi_f34_command(data, RMI_F34_ERASE_ALL, RMI_F34_ERASE_WAIT_MS);
+	flash->erase_ns = ktime_get_ns() - t;
+	if (ret) {
+		dev_err(data->dev, "can not erase the flash: %d\n", ret);
+		goto restart;
+	}
+
+	t = ktime_get_ns();
+	ret = rmi_f34_write_blocks(data, image->data, flash->fw_blocks,
+			RMI_F34_WRITE_FW_BLOCK);
+	if (!ret)
+		ret = rmi_f34_write_blocks(data, image->data + image_size,
+				flash->cfg_blocks, RMI_F34_WRITE_CONFIG_BLOCK);
+	flash->write_ns = ktime_get_ns() - t;
+	if (ret)
+		goto restart;
+
+	t = ktime_get_ns();
+	ret = rmi_f34_verify_config(data, image->data + image_size);
+	flash->verify_ns = ktime_get_ns() - t;
+
+restart:
+	t = ktime_get_ns();
+	restart_ret = rmi_f34_restart(data);
+	flash->reset_ns = ktime_get_ns() - t;
+
+	/* keep the decode path off a device we no longer understand */
+	if (!restart_ret)
+		set_bit(RMI_STARTED, &data->flags);
+	if (!ret)
+		ret = restart_ret;
+	if (test_bit(RMI_OPENED, &data->flags))
+		rmi_workers_start(data);
+
+out:
+	rmi_transport_put(data);
+
+	flash->result = ret;
+	flash->total_ns = ktime_get_ns() - start;
+	if (!ret)
+		dev_info(data->dev, "reflashed in %llu ms\n",
+			 div_u64(flash->total_ns, NSEC_PER_MSEC));
+	return ret;
+}
+
+/*
+ * debugfs: the mock transport benchmark.
+ *
+ * "mock_image" takes a raw register image (offset == RMI address). If none
+ * was loaded, reading "bench" first snapshots the PDT pages of the live
+ * device, data registers excepted. The benchmark then replays discovery and
+ * attention decode on a scratch device backed by the mock transport, which
+ * gives the pure driver cost; the live populate time includes the bus. It
+ * also times a resume of the scratch device while a read stalls. The
+ * image is only touched under regs_mutex.
+ */
+
+#define RMI_BENCH_FRAMES		1000
+#define RMI_BENCH_READS			100
+
+static ssize_t rmi_debugfs_mock_write(struct file *file,
+		const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	struct rmi_data *data = file->private_data;
+	ssize_t ret;
+
+	mutex_lock(&data->regs_mutex);
+
+	if (!data->mock_regs) {
+		data->mock_regs = vzalloc(RMI_MOCK_REGS_SIZE);
+		if (!data->mock_regs) {
+			ret = -ENOMEM;
+			goto unlock;
+		}
+	}
+
+	ret = simple_write_to_buffer(data->mock_regs, RMI_MOCK_REGS_SIZE,
+			ppos, ubuf, count);
+unlock:
+	mutex_unlock(&data->regs_mutex);
+	return ret;
+}
+
+static const struct file_operations rmi_debugfs_mock_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.write	= rmi_debugfs_mock_write,
+	.llseek	= default_llseek,
+};
+
+/*
+ * Copies one PDT page of the live device into @regs, but its data registers:
+ * some of them, like the F01 interrupt status, are cleared on read and the
+ * device would lose the events they hold. The data block of a function runs
+ * up to the next register block of the page, it is left zeroed.
+ */
+static int rmi_mock_snapshot_page(struct rmi_data *data, u8 *regs, int page)
+{
+	struct pdt_entry pdt[(PDT_START_SCAN_LOCATION -
+			      PDT_END_SCAN_LOCATION) / sizeof(struct pdt_entry) + 1];
+	DECLARE_BITMAP(skip, RMI4_PAGE_SIZE);
+	u16 page_start = page * RMI4_PAGE_SIZE;
+	unsigned int pdt_low = PDT_START_SCAN_LOCATION + sizeof(*pdt);
+	unsigned int start, end, next;
+	int count = 0;
+	int i, j;
+	int ret;
+
+	for (i = PDT_START_SCAN_LOCATION; i >= PDT_END_SCAN_LOCATION;
+	     i -= sizeof(*pdt)) {
+		ret = rmi_read_block(data, page_start + i, &pdt[count],
+				     sizeof(*pdt));
+		if (ret)
+			return ret;
+		pdt_low = i;
+		if (RMI4_END_OF_PDT(pdt[count].function_number))
+			break;
+		count++;
+	}
+
+	bitmap_zero(skip, RMI4_PAGE_SIZE);
+	for (i = 0; i < count; i++) {
+		start = pdt[i].data_base_addr;
+		end = pdt_low;
+		for (j = 0; j < count; j++) {
+			u8 bases[] = { pdt[j].query_base_addr,
+				       pdt[j].command_base_addr,
+				       pdt[j].control_base_addr,
+				       pdt[j].data_base_addr };
+			int k;
+
+			for (k = 0; k < ARRAY_SIZE(bases); k++)
+				if (bases[k] > start && bases[k] < end)
+					end = bases[k];
+		}
+		if (start < end)
+			bitmap_set(skip, start, end - start);
+	}
+
+	/* the PDT itself was read above, the rest goes by runs */
+	for (start = 0; start < pdt_low; start = next) {
+		start = find_next_zero_bit(skip, pdt_low, start);
+		if (start >= pdt_low)
+			break;
+		next = find_next_bit(skip, pdt_low, start);
 
-	if (RMI_PAGE(addr) != data->page) {
-		ret = rmi_set_page(hdev, RMI_PAGE(addr));
-		if (ret < 0)
-			goto exit;
+		ret = rmi_read_block(data, page_start + start, regs + start,
+				     next - start);
+		if (ret)
+			return ret;
 	}
 
-	for (retries = 5; retries > 0; retries--) {
-		data->writeReport[0] = RMI_READ_ADDR_REPORT_ID;
-		data->writeReport[1] = 0; /* old 1 byte read count */
-		data->writeReport[2] = addr & 0xFF;
-		data->writeReport[3] = (addr >> 8) & 0xFF;
-		data->writeReport[4] = len  & 0xFF;
-		data->writeReport[5] = (len >> 8) & 0xFF;
+	return rmi_read_block(data, page_start + pdt_low, regs + pdt_low,
+			      RMI4_PAGE_SIZE - pdt_low);
+}
 
-		set_bit(RMI_READ_REQUEST_PENDING, &data->flags);
+/* called with regs_mutex held */
+static int rmi_mock_snapshot(struct rmi_data *data)
+{
+	int page;
+	int ret;
 
-		ret = rmi_write_report(hdev, data->writeReport,
-						data->output_report_size);
-		if (ret != data->output_report_size) {
-			clear_bit(RMI_READ_REQUEST_PENDING, &data->flags);
-			dev_err(&hdev->dev,
-				"failed to write request output report (%d)\n",
-				ret);
-			goto exit;
+	data->mock_regs = vzalloc(RMI_MOCK_REGS_SIZE);
+	if (!data->mock_regs)
+		return -ENOMEM;
+
+	for (page = 0; page < data->pdt_page_count; page++) {
+		ret = rmi_mock_snapshot_page(data,
+				data->mock_regs + page * RMI4_PAGE_SIZE, page);
+		if (ret) {
+			vfree(data->mock_regs);
+			data->mock_regs = NULL;
+			return ret;
 		}
+	}
 
-		bytes_read = 0;
-		bytes_needed = len;
-		while (bytes_read < len) {
-			if (!wait_event_timeout(data->wait, 
-				test_bit(RMI_READ_DATA_PENDING, &data->flags),
-					msecs_to_jiffies(1000))) {
-				hid_warn(hdev, "%s: timeout elapsed\n",
-					 __func__);
-				ret = -EAGAIN;
-				break;
-			}
+	return 0;
+}
 
-			read_input_count = data->readReport[1];
-			memcpy(buf + bytes_read, &data->readReport[2],
-				read_input_count < bytes_needed ?
-					read_input_count : bytes_needed);
+/*
+ * Live register throughput (the F11 data block, back to back), then
+ * snapshot the registers for the mock transport if no image was loaded.
+ */
+static int rmi_bench_live(struct rmi_data *data, u64 *read_ns)
+{
+	u8 *buf;
+	u64 start;
+	int ret;
+	int i;
 
-			bytes_read += read_input_count;
-			bytes_needed -= read_input_count;
-			clear_bit(RMI_READ_DATA_PENDING, &data->flags);
-		}
+	buf = kzalloc(data->f11.report_size, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
 
-		if (ret >= 0) {
-			ret = 0;
+	ret = rmi_transport_get(data);
+	if (ret)
+		goto out;
+
+	start = ktime_get_ns();
+	for (i = 0; i < RMI_BENCH_READS; i++) {
+		ret = rmi_read_block(data, data->f11.data_base_addr, buf,
+				data->f11.report_size);
+		if (ret)
 			break;
-		}
 	}
+	*read_ns = ktime_get_ns() - start;
 
-exit:
-	clear_bit(RMI_READ_REQUEST_PENDING, &data->flags);
-	mutex_unlock(&data->page_mutex);
+	if (!ret && !data->mock_regs)
+		ret = rmi_mock_snapshot(data);
+
+	rmi_transport_put(data);
+out:
+	kfree(buf);
 	return ret;
 }
 
-static inline int rmi_read(struct hid_device *hdev, u16 addr, void *buf)
+/* a scratch device of @data, backed by the mock transport on @regs */
+static struct rmi_data *rmi_mock_alloc(struct rmi_data *data, u8 *regs)
 {
-	return rmi_read_block(hdev, addr, buf, 1);
+	struct rmi_data *mock;
+
+	mock = kzalloc(sizeof(*mock), GFP_KERNEL);
+	if (!mock)
+		return NULL;
+
+	mock->input = input_allocate_device();
+	if (!mock->input) {
+		kfree(mock);
+		return NULL;
+	}
+
+	rmi_xfer_init(mock);
+	spin_lock_init(&mock->poll.lock);
+	ratelimit_state_init(&mock->event_rs, RMI_EVENT_LOG_INTERVAL, 1);
+	mock->dev = data->dev;
+	set_bit(RMI_SCRATCH, &mock->flags);
+	mock->xport = &rmi_mock_ops;
+	mock->xport_priv = regs;
+	mock->max_write_size = RMI4_PAGE_SIZE;
+
+	return mock;
 }
 
-static void rmi_f11_process_touch(struct rmi_data *hdata, int slot,
-		u8 finger_state, u8 *touch_data)
+static void rmi_mock_free(struct rmi_data *mock)
 {
-	int x, y, wx, wy;
-	int wide, major, minor;
-	int z;
+	input_free_device(mock->input);
+	kfree(mock);
+}
 
-	input_mt_slot(hdata->input, slot);
-	input_mt_report_slot_state(hdata->input, MT_TOOL_FINGER,
-			finger_state == 0x01);
-	if (finger_state == 0x01) {
-		x = (touch_data[0] << 4) | (touch_data[2] & 0x0F);
-		y = (touch_data[1] << 4) | (touch_data[2] >> 4);
-		wx = touch_data[3] & 0x0F;
-		wy = touch_data[3] >> 4;
-		wide = (wx > wy);
-		major = max(wx, wy);
-		minor = min(wx, wy);
-		z = touch_data[4];
+struct rmi_bench_stall {
+	struct work_struct work;
+	struct rmi_data *mock;
+	int ret;
+};
 
-		/* y is inverted */
-		y = hdata->max_y - y;
+static void rmi_bench_stall_work(struct work_struct *work)
+{
+	struct rmi_bench_stall *stall = container_of(work,
+			struct rmi_bench_stall, work);
+	u8 status;
 
-		input_event(hdata->input, EV_ABS, ABS_MT_POSITION_X, x);
-		input_event(hdata->input, EV_ABS, ABS_MT_POSITION_Y, y);
-		input_event(hdata->input, EV_ABS, ABS_MT_ORIENTATION, wide);
-		input_event(hdata->input, EV_ABS, ABS_MT_PRESSURE, z);
-		input_event(hdata->input, EV_ABS, ABS_MT_TOUCH_MAJOR, major);
-		input_event(hdata->input, EV_ABS, ABS_MT_TOUCH_MINOR, minor);
-	}
+	stall->ret = rmi_read(stall->mock, stall->mock->f01.data_base_addr,
+			      &status);
 }
 
-static void rmi_reset_work(struct work_struct *work)
+/* starts a normal read on the scratch device, which stalls on the bus */
+static void rmi_bench_stall_begin(struct rmi_data *mock,
+		struct rmi_bench_stall *stall)
 {
-	struct rmi_data *hdata = container_of(work, struct rmi_data,
-						reset_work);
+	int i;
 
-	/* switch the device to RMI if we receive a generic mouse report */
-	rmi_set_mode(hdata->hdev, RMI_MODE_ATTN_REPORTS);
+	stall->mock = mock;
+	mock->xport = &rmi_mock_stall_ops;
+
+	INIT_WORK_ONSTACK(&stall->work, rmi_bench_stall_work);
+	queue_work(system_unbound_wq, &stall->work);
+	for (i = 0; i < 100 && !mutex_is_locked(&mock->xfer_mutex); i++)
+		usleep_range(100, 200);
 }
 
-static inline int rmi_schedule_reset(struct hid_device *hdev)
+/* returns the result of the stalled read */
+static int rmi_bench_stall_end(struct rmi_data *mock,
+		struct rmi_bench_stall *stall)
 {
-	struct rmi_data *hdata = hid_get_drvdata(hdev);
-	return schedule_work(&hdata->reset_work);
+	flush_work(&stall->work);
+	destroy_work_on_stack(&stall->work);
+	mock->xport = &rmi_mock_ops;
+
+	return stall->ret;
 }
 
-static int rmi_f11_input_event(struct hid_device *hdev, u8 irq, u8 *data,
-		int size)
+/*
+ * Resumes the open scratch device while a normal read is stalled on the
+ * bus, the case the urgent sections are for: the resume has to abort the
+ * read before it can wake the sensor.
+ */
+static int rmi_bench_resume(struct rmi_data *mock, int *read_ret)
 {
-	struct rmi_data *hdata = hid_get_drvdata(hdev);
-	int offset;
+	struct rmi_bench_stall stall;
+	int ret;
+
+	set_bit(RMI_OPENED, &mock->flags);
+
+	rmi_bench_stall_begin(mock, &stall);
+	ret = rmi_resume(mock, false);
+	*read_ret = rmi_bench_stall_end(mock, &stall);
+
+	clear_bit(RMI_OPENED, &mock->flags);
+	return ret;
+}
+
+/*
+ * Runs the reset work while a normal read is stalled. Its urgent section
+ * does no transaction of its own, the normal ones must still go through
+ * once it is over: returns -ECANCELED if they are left aborted.
+ */
+static int rmi_bench_reset(struct rmi_data *mock, int *read_ret)
+{
+	struct rmi_bench_stall stall;
+
+	rmi_bench_stall_begin(mock, &stall);
+	rmi_reset_work(&mock->reset_work);
+	*read_ret = rmi_bench_stall_end(mock, &stall);
+
+	return rmi_xfer_aborted(mock) ? -ECANCELED : 0;
+}
+
+static int rmi_debugfs_bench_show(struct seq_file *s, void *unused)
+{
+	struct rmi_data *data = s->private;
+	struct rmi_data *mock;
+	u8 *frame;
+	int frame_len;
+	u64 populate_ns, fetch_ns, decode_ns, read_ns, start;
+	int stall_ret, reset_read_ret, reset_ret;
+	int ret;
 	int i;
 
-	if (size < hdata->f11.report_size)
-		return 0;
+	mutex_lock(&data->regs_mutex);
 
-	if (!(irq & hdata->f11.irq_mask))
-		return 0;
+	ret = rmi_bench_live(data, &read_ns);
+	if (ret)
+		goto unlock;
 
-	offset = (hdata->max_fingers >> 2) + 1;
-	for (i = 0; i < hdata->max_fingers; i++) {
-		int fs_byte_position = i >> 2;
-		int fs_bit_position = (i & 0x3) << 1;
-		int finger_state = (data[fs_byte_position] >> fs_bit_position) &
-					0x03;
+	mock = rmi_mock_alloc(data, data->mock_regs);
+	if (!mock) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	start = ktime_get_ns();
+	ret = rmi_populate(mock);
+	populate_ns = ktime_get_ns() - start;
+	if (ret)
+		goto out;
+
+	rmi_setup_input(mock, mock->input);
+	set_bit(RMI_STARTED, &mock->flags);
 
-		rmi_f11_process_touch(hdata, i, finger_state,
-				&data[offset + 5 * i]);
+	frame = kzalloc(rmi_attn_frame_size(mock), GFP_KERNEL);
+	if (!frame) {
+		ret = -ENOMEM;
+		goto out;
 	}
-	input_mt_sync_frame(hdata->input);
-	input_sync(hdata->input);
-	return hdata->f11.report_size;
+
+	start = ktime_get_ns();
+	frame_len = rmi_fetch_attn_frame(mock,
+			mock->f11.irq_mask | mock->f30.irq_mask,
+			frame, rmi_attn_frame_size(mock), NULL, 0, 0);
+	fetch_ns = ktime_get_ns() - start;
+	if (frame_len < 0) {
+		ret = frame_len;
+		kfree(frame);
+		goto out;
+	}
+
+	start = ktime_get_ns();
+	for (i = 0; i < RMI_BENCH_FRAMES; i++)
+		rmi_input_event(mock, frame, frame_len);
+	decode_ns = ktime_get_ns() - start;
+	kfree(frame);
+
+	ret = rmi_bench_resume(mock, &stall_ret);
+	if (ret)
+		goto out;
+
+	reset_ret = rmi_bench_reset(mock, &reset_read_ret);
+
+	seq_printf(s, "transport:\t\t%s\n", data->xport->name);
+	seq_printf(s, "live probe:\t\t%llu ns\n", data->probe_ns);
+	seq_printf(s, "live populate:\t\t%llu ns\n", data->populate_ns);
+	seq_printf(s, "live read:\t\t%llu ns/read (%d bytes, %llu bytes/s)\n",
+		   div_u64(read_ns, RMI_BENCH_READS), data->f11.report_size,
+		   div64_u64((u64)data->f11.report_size * RMI_BENCH_READS *
+			     NSEC_PER_SEC, read_ns ?: 1));
+	seq_printf(s, "mock populate:\t\t%llu ns\n", populate_ns);
+	seq_printf(s, "mock frame fetch:\t%llu ns (%d bytes)\n", fetch_ns,
+		   frame_len);
+	seq_printf(s, "mock decode:\t\t%llu ns/frame (%d frames)\n",
+		   div_u64(decode_ns, RMI_BENCH_FRAMES), RMI_BENCH_FRAMES);
+	seq_printf(s, "mock resume:\t\t%llu us with a read stalled for %u ms (read %d)\n",
+		   div_u64(mock->pm_stats.resume_last_ns, NSEC_PER_USEC),
+		   RMI_MOCK_STALL_MS, stall_ret);
+	seq_printf(s, "mock reset:\t\tstalled read %d, next reads %s\n",
+		   reset_read_ret, reset_ret ? "still aborted" : "go through");
+
+out:
+	rmi_mock_free(mock);
+unlock:
+	mutex_unlock(&data->regs_mutex);
+	return ret;
 }
 
-static int rmi_f30_input_event(struct hid_device *hdev, u8 irq, u8 *data,
-		int size)
+static int rmi_debugfs_bench_open(struct inode *inode, struct file *file)
 {
-	struct rmi_data *hdata = hid_get_drvdata(hdev);
+	return single_open(file, rmi_debugfs_bench_show, inode->i_private);
+}
+
+static const struct file_operations rmi_debugfs_bench_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rmi_debugfs_bench_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int rmi_debugfs_xfer_stats_show(struct seq_file *s, void *unused)
+{
+	struct rmi_data *data = s->private;
+	/* a racy snapshot, a stalled transaction must not block it */
+	struct rmi_xfer_stats stats = data->xfer_stats;
+
+	seq_printf(s, "transport:\t%s\n", data->xport->name);
+	seq_printf(s, "reads:\t\t%llu (%llu bytes, %llu ns)\n",
+		   stats.reads, stats.read_bytes, stats.read_ns);
+	seq_printf(s, "writes:\t\t%llu (%llu bytes, %llu ns)\n",
+		   stats.writes, stats.write_bytes, stats.write_ns);
+	seq_printf(s, "page switches:\t%llu\n", stats.page_switches);
+	seq_printf(s, "errors:\t\t%llu\n", stats.errors);
+	seq_printf(s, "aborts:\t\t%llu (%llu preemptions)\n", stats.aborts,
+		   stats.preemptions);
+	seq_printf(s, "rejected:\t%llu\n", stats.rejected);
+	if (data->hdev)
+		seq_printf(s, "pool waits:\t%llu (%d transactions)\n",
+			   data->pool.waits, RMI_XFER_POOL_SIZE);
+	seq_printf(s, "urgent wait:\t%llu ns (max %llu ns)\n",
+		   stats.urgent_wait_ns, stats.urgent_wait_max_ns);
+
+	return 0;
+}
+
+static int rmi_debugfs_xfer_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rmi_debugfs_xfer_stats_show,
+			inode->i_private);
+}
+
+static const struct file_operations rmi_debugfs_xfer_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rmi_debugfs_xfer_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void rmi_debugfs_show_block(struct seq_file *s, const char *name,
+		struct rmi_function *f, int *offset)
+{
+	if (!f->report_size)
+		return;
+
+	seq_printf(s, "%s:\tirq mask 0x%02lx, offset %d, size %u\n", name,
+		   f->irq_mask, *offset, f->report_size);
+	*offset += f->report_size;
+}
+
+static int rmi_debugfs_attn_layout_show(struct seq_file *s, void *unused)
+{
+	struct rmi_data *data = s->private;
+	struct rmi_f11_sensor *sensor;
+	int offset = 2;
 	int i;
-	int button = 0;
-	bool value;
 
-	if (!(irq & hdata->f30.irq_mask))
+	seq_printf(s, "report id:\t0x%02x\n", RMI_ATTN_REPORT_ID);
+	seq_printf(s, "irq offset:\t1\n");
+	for (i = 0; i < data->sensor_count; i++) {
+		sensor = &data->sensors[i];
+		seq_printf(s, "sensor %d:\tf11 +%u, %u fingers, max x/y %u %u\n",
+			   i, sensor->data_offset, sensor->max_fingers,
+			   sensor->max_x, sensor->max_y);
+		if (sensor->gesture_query[0] || sensor->gesture_query[1])
+			seq_printf(s, "gestures:\tf11 +%u, enabled %#04x\n",
+				   sensor->data_offset + sensor->gesture_offset,
+				   sensor->gestures);
+	}
+
+	/* offsets when every block is present */
+	if (data->f11.interrupt_base < data->f30.interrupt_base) {
+		rmi_debugfs_show_block(s, "f11", &data->f11, &offset);
+		rmi_debugfs_show_block(s, "f30", &data->f30, &offset);
+	} else {
+		rmi_debugfs_show_block(s, "f30", &data->f30, &offset);
+		rmi_debugfs_show_block(s, "f11", &data->f11, &offset);
+	}
+
+	return 0;
+}
+
+static int rmi_debugfs_attn_layout_open(struct inode *inode,
+		struct file *file)
+{
+	return single_open(file, rmi_debugfs_attn_layout_show,
+			inode->i_private);
+}
+
+static const struct file_operations rmi_debugfs_attn_layout_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rmi_debugfs_attn_layout_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int rmi_debugfs_attn_stats_show(struct seq_file *s, void *unused)
+{
+	struct rmi_data *data = s->private;
+	struct rmi_attn_stats stats = data->attn_stats;
+
+	seq_printf(s, "frames:\t\t%llu\n", stats.frames);
+	seq_printf(s, "short frames:\t%llu\n", stats.short_frames);
+	seq_printf(s, "reassembled:\t%llu\n", stats.reassembled_frames);
+	seq_printf(s, "incomplete:\t%llu\n", stats.incomplete_frames);
+	seq_printf(s, "decode:\t\t%llu ns/frame (max %llu ns)\n",
+		   div64_u64(stats.decode_ns, stats.frames ?: 1),
+		   stats.decode_max_ns);
+	seq_printf(s, "decode mode:\t%s\n",
+		   data->ring.enabled ? "threaded" : "inline");
+	seq_printf(s, "irq context:\t%llu ns/report (max %llu ns)\n",
+		   div64_u64(stats.irq_ns, stats.irq_frames ?: 1),
+		   stats.irq_max_ns);
+	seq_printf(s, "latency:\t%llu ns/frame (max %llu ns)\n",
+		   div64_u64(stats.latency_ns, stats.latency_frames ?: 1),
+		   stats.latency_max_ns);
+	seq_printf(s, "overruns:\t%llu\n", stats.overruns);
+	seq_printf(s, "gestures:\t%llu\n", stats.gestures);
+	seq_printf(s, "palms:\t\t%llu (%llu frames flagged)\n",
+		   stats.palms, stats.palm_frames);
+	seq_printf(s, "unknown irq:\t%llu (sources %02lx)\n",
+		   data->event_stats.unknown_irq,
+		   data->event_stats.unknown_irq_mask);
+	seq_printf(s, "stray reads:\t%llu\n", data->event_stats.stray_reads);
+	seq_printf(s, "short reads:\t%llu\n", data->event_stats.short_reads);
+
+	return 0;
+}
+
+static int rmi_debugfs_attn_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rmi_debugfs_attn_stats_show,
+			inode->i_private);
+}
+
+static const struct file_operations rmi_debugfs_attn_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rmi_debugfs_attn_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int rmi_debugfs_pm_stats_show(struct seq_file *s, void *unused)
+{
+	struct rmi_data *data = s->private;
+	struct rmi_pm_stats stats = data->pm_stats;
+
+	seq_printf(s, "opens:\t\t%llu\n", stats.opens);
+	seq_printf(s, "open latency:\t%llu us (max %llu us, budget %u ms, %llu over)\n",
+		   div_u64(stats.open_last_ns, NSEC_PER_USEC),
+		   div_u64(stats.open_max_ns, NSEC_PER_USEC),
+		   open_budget_ms, stats.open_over_budget);
+	seq_printf(s, "suspends:\t%llu (last %llu us)\n", stats.suspends,
+		   div_u64(stats.suspend_last_ns, NSEC_PER_USEC));
+	seq_printf(s, "resumes:\t%llu (last %llu us, max %llu us)\n",
+		   stats.resumes, div_u64(stats.resume_last_ns, NSEC_PER_USEC),
+		   div_u64(stats.resume_max_ns, NSEC_PER_USEC));
+	seq_printf(s, "wake frames:\t%llu\n", stats.wake_frames);
+	seq_printf(s, "wake suspend:\t%llu ns (boottime)\n",
+		   stats.wake_suspend_ns);
+	seq_printf(s, "wake frame:\t%llu ns (boottime)\n", stats.wake_frame_ns);
+	seq_printf(s, "wake resume:\t%llu ns (boottime)\n",
+		   stats.wake_resume_ns);
+
+	return 0;
+}
+
+static int rmi_debugfs_pm_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rmi_debugfs_pm_stats_show, inode->i_private);
+}
+
+static const struct file_operations rmi_debugfs_pm_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rmi_debugfs_pm_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int rmi_debugfs_rate_stats_show(struct seq_file *s, void *unused)
+{
+	static const char * const names[] = { "fast", "slow" };
+	struct rmi_data *data = s->private;
+	struct rmi_rate *rate = &data->rate;
+	struct rmi_rate_stats stats = rate->stats;
+	u64 decode_ns = 0;
+	int i;
+
+	if (!rate->enabled) {
+		seq_puts(s, "disabled\n");
 		return 0;
+	}
 
-	for (i = 0; i < hdata->gpio_led_count; i++) {
-		if (test_bit(i, &hdata->button_mask)){
-			value = (data[i / 8] >> (i & 0x07)) & BIT(0);
-			if (test_bit(i, &hdata->button_state_mask))
-				value = !value;
-			input_event(hdata->input, EV_KEY, BTN_LEFT + button++,
-					value);
-		}
+	stats.mode_ns[rate->mode] += ktime_get_ns() - rate->since_ns;
+	if (data->attn_stats.frames)
+		decode_ns = div64_u64(data->attn_stats.decode_ns,
+				      data->attn_stats.frames);
+
+	seq_printf(s, "mode:\t\t%s\n", names[rate->mode]);
+	for (i = 0; i < RMI_RATE_MODES; i++) {
+		u64 ms = div_u64(stats.mode_ns[i], NSEC_PER_MSEC);
+
+		seq_printf(s, "%s:\t\t%llu frames in %llu ms (%llu/s), delta %u/%u\n",
+			   names[i], stats.frames[i], ms,
+			   ms ? div64_u64(stats.frames[i] * MSEC_PER_SEC, ms) : 0,
+			   rate->delta[i][0], rate->delta[i][1]);
+		/* what the frames cost, on the bus and to decode */
+		seq_printf(s, "%s cost:\t%llu bytes, %llu us decoding\n",
+			   names[i],
+			   stats.frames[i] * rmi_attn_frame_size(data),
+			   div_u64(stats.frames[i] * decode_ns,
+				   NSEC_PER_USEC));
 	}
-	return hdata->f30.report_size;
+	seq_printf(s, "switches:\t%llu (%llu errors), last %llu us, max %llu us\n",
+		   stats.switches, stats.errors,
+		   div_u64(stats.switch_last_ns, NSEC_PER_USEC),
+		   div_u64(stats.switch_max_ns, NSEC_PER_USEC));
+	/* measured on the bus, page selects included */
+	seq_printf(s, "switch xfers:\t%llu (last %llu)\n",
+		   stats.switch_xfers, stats.switch_xfers_last);
+	seq_printf(s, "onset latency:\t%llu us (max %llu us)\n",
+		   div_u64(stats.onset_last_ns, NSEC_PER_USEC),
+		   div_u64(stats.onset_max_ns, NSEC_PER_USEC));
+
+	return 0;
 }
 
-static int rmi_input_event(struct hid_device *hdev, u8 *data, int size)
+static int rmi_debugfs_rate_stats_open(struct inode *inode, struct file *file)
 {
-	struct rmi_data *hdata = hid_get_drvdata(hdev);
-	unsigned long irq_mask = 0;
-	unsigned index = 2;
+	return single_open(file, rmi_debugfs_rate_stats_show, inode->i_private);
+}
 
-	if (!(test_bit(RMI_STARTED, &hdata->flags)))
+static const struct file_operations rmi_debugfs_rate_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rmi_debugfs_rate_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * Raw register access. A write to the regs file is a batch of commands,
+ * separated by newlines or ';':
+ *
+ *	r <addr> <len>		read <len> bytes at <addr>
+ *	w <addr> <byte>...	write the bytes at <addr>
+ *
+ * Writes to adjacent addresses are coalesced into one block write. The
+ * whole batch runs with the transport held open, and reading the file
+ * returns one line per access with its duration.
+ */
+#define RMI_REGS_MAX_LEN		256
+#define RMI_REGS_OUT_SIZE		(16 * 1024)
+
+struct rmi_regs_write {
+	u16 addr;
+	int len;
+	u8 buf[RMI_REGS_MAX_LEN];
+};
+
+static void rmi_regs_print(struct rmi_data *data, char op, u16 addr,
+		const u8 *buf, int len, int ret, u64 ns)
+{
+	char *out = data->regs_out;
+	size_t size = RMI_REGS_OUT_SIZE;
+	size_t n = data->regs_len;
+	int i;
+
+	n += scnprintf(out + n, size - n, "%c %#06x %d:", op, addr, len);
+	if (ret)
+		n += scnprintf(out + n, size - n, " error %d", ret);
+	else if (buf)
+		for (i = 0; i < len; i++)
+			n += scnprintf(out + n, size - n, " %02x", buf[i]);
+	n += scnprintf(out + n, size - n, " (%llu us)\n",
+		       div_u64(ns, NSEC_PER_USEC));
+	data->regs_len = n;
+}
+
+/* one access per page, rmi_read_block() only selects the first one */
+static int rmi_regs_access(struct rmi_data *data, char op, u16 addr,
+		u8 *buf, int len)
+{
+	int chunk;
+	u64 start;
+	int ret;
+
+	/* the address space is 16 bits, nothing wraps around to page 0 */
+	if (addr + len > 0x10000)
+		return -EINVAL;
+
+	for (; len; addr += chunk, buf += chunk, len -= chunk) {
+		chunk = min_t(int, len, RMI4_PAGE_SIZE - (addr & 0xff));
+
+		start = ktime_get_ns();
+		if (op == 'r')
+			ret = rmi_read_block(data, addr, buf, chunk);
+		else
+			ret = rmi_write_block(data, addr, buf, chunk);
+		rmi_regs_print(data, op, addr, op == 'r' ? buf : NULL, chunk,
+			       ret, ktime_get_ns() - start);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int rmi_regs_flush(struct rmi_data *data, struct rmi_regs_write *w)
+{
+	int ret;
+
+	if (!w->len)
 		return 0;
 
-	irq_mask |= hdata->f11.irq_mask;
-	irq_mask |= hdata->f30.irq_mask;
+	ret = rmi_regs_access(data, 'w', w->addr, w->buf, w->len);
+	w->len = 0;
+	return ret;
+}
 
-	if (!(data[1] & irq_mask))
-		/*
-		 * No intr sources which are supported by this
-		 * driver were found. Return 0 and let the report
-		 * go to hidraw in case there is a userspace tool
-		 * handling these intr sources.
-		 */
+static int rmi_regs_command(struct rmi_data *data, char *cmd,
+		struct rmi_regs_write *w, u8 *buf)
+{
+	char *op = strsep(&cmd, " \t");
+	char *arg;
+	u16 addr, len;
+	u8 value;
+	int ret;
+
+	if (!*op)
 		return 0;
 
-	if (data[1] & ~irq_mask)
-		hid_warn(hdev, "unknown intr source:%02lx %s:%d\n",
-			data[1] & ~irq_mask, __FILE__, __LINE__);
+	arg = strsep(&cmd, " \t");
+	if (!arg || kstrtou16(arg, 0, &addr))
+		return -EINVAL;
 
-	if (hdata->f11.interrupt_base < hdata->f30.interrupt_base) {
-		index += rmi_f11_input_event(hdev, data[1], &data[index],
-				size - index);
-		index += rmi_f30_input_event(hdev, data[1], &data[index],
-				size - index);
-	} else {
-		index += rmi_f30_input_event(hdev, data[1], &data[index],
-				size - index);
-		index += rmi_f11_input_event(hdev, data[1], &data[index],
-				size - index);
+	if (!strcmp(op, "r")) {
+		arg = strsep(&cmd, " \t");
+		if (!arg || kstrtou16(arg, 0, &len) || !len ||
+		    len > RMI_REGS_MAX_LEN)
+			return -EINVAL;
+
+		ret = rmi_regs_flush(data, w);
+		if (ret)
+			return ret;
+
+		return rmi_regs_access(data, 'r', addr, buf, len);
+	}
+
+	if (strcmp(op, "w"))
+		return -EINVAL;
+
+	if (w->len && (w->addr + w->len != addr ||
+		       w->len == RMI_REGS_MAX_LEN)) {
+		ret = rmi_regs_flush(data, w);
+		if (ret)
+			return ret;
+	}
+	if (!w->len)
+		w->addr = addr;
+
+	while ((arg = strsep(&cmd, " \t"))) {
+		if (!*arg)
+			continue;
+		if (kstrtou8(arg, 0, &value))
+			return -EINVAL;
+		if (w->len == RMI_REGS_MAX_LEN) {
+			ret = rmi_regs_flush(data, w);
+			if (ret)
+				return ret;
+			w->addr = addr;
+		}
+		w->buf[w->len++] = value;
+		addr++;
 	}
 
-	return 1;
+	return 0;
 }
 
-static int rmi_read_data_event(struct hid_device *hdev, u8 *data, int size)
+static ssize_t rmi_debugfs_regs_write(struct file *file,
+		const char __user *ubuf, size_t count, loff_t *ppos)
 {
-	struct rmi_data *hdata = hid_get_drvdata(hdev);
+	struct rmi_data *data = file->private_data;
+	struct rmi_regs_write *w;
+	char *cmds, *cur, *cmd;
+	u8 *buf;
+	int ret;
 
-	if (!test_bit(RMI_READ_REQUEST_PENDING, &hdata->flags)) {
-		hid_info(hdev, "no read request pending\n");
-		return 0;
+	if (count > PAGE_SIZE)
+		return -E2BIG;
+
+	cmds = memdup_user_nul(ubuf, count);
+	if (IS_ERR(cmds))
+		return PTR_ERR(cmds);
+
+	w = kzalloc(sizeof(*w), GFP_KERNEL);
+	buf = kmalloc(RMI_REGS_MAX_LEN, GFP_KERNEL);
+	if (!w || !buf) {
+		ret = -ENOMEM;
+		goto out;
 	}
 
-	memcpy(hdata->readReport, data, size < hdata->input_report_size ?
-			size : hdata->input_report_size);
-	set_bit(RMI_READ_DATA_PENDING, &hdata->flags);
-	wake_up(&hdata->wait);
+	mutex_lock(&data->regs_mutex);
 
-	return 1;
+	if (!data->regs_out) {
+		data->regs_out = vmalloc(RMI_REGS_OUT_SIZE);
+		if (!data->regs_out) {
+			ret = -ENOMEM;
+			goto unlock;
+		}
+	}
+	data->regs_len = 0;
+
+	ret = rmi_transport_get(data);
+	if (ret)
+		goto unlock;
+
+	cur = cmds;
+	while ((cmd = strsep(&cur, "\n;"))) {
+		ret = rmi_regs_command(data, strim(cmd), w, buf);
+		if (ret)
+			break;
+	}
+	if (!ret)
+		ret = rmi_regs_flush(data, w);
+
+	rmi_transport_put(data);
+unlock:
+	mutex_unlock(&data->regs_mutex);
+out:
+	kfree(buf);
+	kfree(w);
+	kfree(cmds);
+	return ret ? ret : count;
 }
 
-static int rmi_raw_event(struct hid_device *hdev,
-		struct hid_report *report, u8 *data, int size)
+static ssize_t rmi_debugfs_regs_read(struct file *file, char __user *ubuf,
+		size_t count, loff_t *ppos)
 {
-	switch (data[0]) {
-	case RMI_READ_DATA_REPORT_ID:
-		return rmi_read_data_event(hdev, data, size);
-	case RMI_ATTN_REPORT_ID:
-		return rmi_input_event(hdev, data, size);
-	case RMI_MOUSE_REPORT_ID:
-		rmi_schedule_reset(hdev);
-		break;
-	}
+	struct rmi_data *data = file->private_data;
+	ssize_t ret;
 
-	return 0;
+	mutex_lock(&data->regs_mutex);
+	ret = simple_read_from_buffer(ubuf, count, ppos, data->regs_out,
+			data->regs_len);
+	mutex_unlock(&data->regs_mutex);
+
+	return ret;
 }
 
-static int rmi_post_reset(struct hid_device *hdev)
+static const struct file_operations rmi_debugfs_regs_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.read	= rmi_debugfs_regs_read,
+	.write	= rmi_debugfs_regs_write,
+	.llseek	= default_llseek,
+};
+
+/*
+ * Writing a firmware name to "reflash" flashes it (looked up through
+ * request_firmware()), reading the file gives the timings of the last
+ * update.
+ */
+static int rmi_debugfs_reflash_show(struct seq_file *s, void *unused)
 {
-	return rmi_set_mode(hdev, RMI_MODE_ATTN_REPORTS);
+	struct rmi_data *data = s->private;
+	struct rmi_flash *flash = &data->flash;
+
+	/* rmi_f34_flash() updates the timings under regs_mutex */
+	mutex_lock(&data->regs_mutex);
+	seq_printf(s, "result:\t\t%d\n", flash->result);
+	seq_printf(s, "blocks:\t\t%u firmware, %u config, %u bytes\n",
+		   flash->fw_blocks, flash->cfg_blocks, flash->block_size);
+	seq_printf(s, "total:\t\t%llu ms\n",
+		   div_u64(flash->total_ns, NSEC_PER_MSEC));
+	seq_printf(s, "enable:\t\t%llu ms\n",
+		   div_u64(flash->enable_ns, NSEC_PER_MSEC));
+	seq_printf(s, "erase:\t\t%llu ms\n",
+		   div_u64(flash->erase_ns, NSEC_PER_MSEC));
+	seq_printf(s, "write:\t\t%llu ms\n",
+		   div_u64(flash->write_ns, NSEC_PER_MSEC));
+	seq_printf(s, "verify:\t\t%llu ms\n",
+		   div_u64(flash->verify_ns, NSEC_PER_MSEC));
+	seq_printf(s, "reset:\t\t%llu ms\n",
+		   div_u64(flash->reset_ns, NSEC_PER_MSEC));
+	seq_printf(s, "status polls:\t%llu\n", flash->polls);
+	mutex_unlock(&data->regs_mutex);
+
+	return 0;
 }
 
-static int rmi_post_resume(struct hid_device *hdev)
+static int rmi_debugfs_reflash_open(struct inode *inode, struct file *file)
 {
-	return rmi_set_mode(hdev, RMI_MODE_ATTN_REPORTS);
+	return single_open(file, rmi_debugfs_reflash_show, inode->i_private);
 }
 
-#define RMI4_MAX_PAGE 0xff
-#define RMI4_PAGE_SIZE 0x0100
+static ssize_t rmi_debugfs_reflash_write(struct file *file,
+		const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct rmi_data *data = s->private;
+	const struct firmware *fw;
+	char *name;
+	int ret;
 
-#define PDT_START_SCAN_LOCATION 0x00e9
-#define PDT_END_SCAN_LOCATION	0x0005
-#define RMI4_END_OF_PDT(id) ((id) == 0x00 || (id) == 0xff)
+	name = memdup_user_nul(ubuf, min_t(size_t, count, NAME_MAX));
+	if (IS_ERR(name))
+		return PTR_ERR(name);
 
-struct pdt_entry {
-	u8 query_base_addr:8;
-	u8 command_base_addr:8;
-	u8 control_base_addr:8;
-	u8 data_base_addr:8;
-	u8 interrupt_source_count:3;
-	u8 bits3and4:2;
-	u8 function_version:2;
-	u8 bit7:1;
-	u8 function_number:8;
-} __attribute__((__packed__));
+	ret = request_firmware(&fw, strim(name), data->dev);
+	if (ret) {
+		dev_err(data->dev, "can not load %s: %d\n", name, ret);
+		goto out;
+	}
 
-static inline unsigned long rmi_gen_mask(unsigned irq_base, unsigned irq_count)
-{
-	return GENMASK(irq_count + irq_base - 1, irq_base);
+	mutex_lock(&data->regs_mutex);
+	ret = rmi_f34_flash(data, fw);
+	mutex_unlock(&data->regs_mutex);
+
+	release_firmware(fw);
+out:
+	kfree(name);
+	return ret ? ret : count;
 }
 
-static void rmi_register_function(struct rmi_data *data,
-	struct pdt_entry *pdt_entry, int page, unsigned interrupt_count)
+static const struct file_operations rmi_debugfs_reflash_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rmi_debugfs_reflash_open,
+	.read		= seq_read,
+	.write		= rmi_debugfs_reflash_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static ssize_t rmi_debugfs_profile_read(struct file *file,
+		char __user *ubuf, size_t count, loff_t *ppos)
 {
-	struct rmi_function *f = NULL;
-	u16 page_base = page << 8;
+	struct rmi_data *data = file->private_data;
+	u8 buf[RMI_PROFILE_MAX_SIZE];
+	int len;
 
-	switch (pdt_entry->function_number) {
-	case 0x11:
-		f = &data->f11;
-		break;
-	case 0x30:
-		f = &data->f30;
-		break;
-	}
+	len = rmi_profile_export(data, buf);
 
-	if (f) {
-		f->page = page;
-		f->query_base_addr = page_base | pdt_entry->query_base_addr;
-		f->command_base_addr = page_base | pdt_entry->command_base_addr;
-		f->control_base_addr = page_base | pdt_entry->control_base_addr;
-		f->data_base_addr = page_base | pdt_entry->data_base_addr;
-		f->interrupt_base = interrupt_count;
-		f->interrupt_count = pdt_entry->interrupt_source_count;
-		f->irq_mask = rmi_gen_mask(f->interrupt_base,
-						f->interrupt_count);
-	}
+	return simple_read_from_buffer(ubuf, count, ppos, buf, len);
 }
 
-static int rmi_scan_pdt(struct hid_device *hdev)
+/* a profile is applied as a whole, from a single write */
+static ssize_t rmi_debugfs_profile_write(struct file *file,
+		const char __user *ubuf, size_t count, loff_t *ppos)
 {
-	struct rmi_data *data = hid_get_drvdata(hdev);
-	struct pdt_entry entry;
-	int page;
-	bool page_has_function;
-	int i;
-	int retval;
-	int interrupt = 0;
-	u16 page_start, pdt_start , pdt_end;
+	struct rmi_data *data = file->private_data;
+	u8 *buf;
+	int ret;
 
-	hid_info(hdev, "Scanning PDT...\n");
+	if (*ppos || count > RMI_PROFILE_MAX_SIZE)
+		return -EINVAL;
 
-	for (page = 0; (page <= RMI4_MAX_PAGE); page++) {
-		page_start = RMI4_PAGE_SIZE * page;
-		pdt_start = page_start + PDT_START_SCAN_LOCATION;
-		pdt_end = page_start + PDT_END_SCAN_LOCATION;
+	buf = memdup_user(ubuf, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
 
-		page_has_function = false;
-		for (i = pdt_start; i >= pdt_end; i -= sizeof(entry)) {
-			retval = rmi_read_block(hdev, i, &entry, sizeof(entry));
-			if (retval) {
-				hid_err(hdev,
-					"Read of PDT entry at %#06x failed.\n",
-					i);
-				goto error_exit;
-			}
+	mutex_lock(&data->regs_mutex);
+	ret = rmi_profile_apply(data, buf, count);
+	mutex_unlock(&data->regs_mutex);
 
-			if (RMI4_END_OF_PDT(entry.function_number))
-				break;
+	kfree(buf);
+	return ret ? ret : count;
+}
 
-			page_has_function = true;
+static const struct file_operations rmi_debugfs_profile_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.read	= rmi_debugfs_profile_read,
+	.write	= rmi_debugfs_profile_write,
+	.llseek	= default_llseek,
+};
 
-			hid_info(hdev, "Found F%02X on page %#04x\n",
-					entry.function_number, page);
+/*
+ * debugfs: the multi-device scaling benchmark.
+ *
+ * Reading "scale" runs the mock benchmark on 1, 2, 4... up to the number of
+ * devices written to the file (RMI_SCALE_DEVICES by default), all at once:
+ * every scratch device has its own copy of the register image and its own
+ * worker. They first populate together, then each one decodes
+ * RMI_BENCH_FRAMES attention frames through the same path as the
+ * transports. Per-device times should stay flat as the count grows, the
+ * steps where they do not are flagged as contended.
+ *
+ * Only populate and decode are measured: the scratch devices do not go
+ * through probe, the transport, input registration or the works. The
+ * footprint is an estimate for the real device, not a measure.
+ */
 
-			rmi_register_function(data, &entry, page, interrupt);
-			interrupt += entry.interrupt_source_count;
-		}
+#define RMI_SCALE_DEVICES		16
+#define RMI_SCALE_MAX_DEVICES		64
 
-		if (!page_has_function)
-			break;
-	}
+struct rmi_scale_dev {
+	struct work_struct work;
+	struct rmi_data *mock;
+	u8 *regs;
+	u8 *frame;
+	int frame_len;
+	int ret;
+	u64 populate_ns;
+	u64 decode_ns;
+	u64 worst_ns;
+};
 
-	hid_info(hdev, "%s: Done with PDT scan.\n", __func__);
-	retval = 0;
+/*
+ * Memory held by a bound device: the driver allocations, and the input
+ * devices counted at their struct size. The input core allocates a bit
+ * more behind them (MT slots, event buffers), so this is an estimate.
+ */
+static size_t rmi_footprint(struct rmi_data *data)
+{
+	size_t size = sizeof(*data);
+	int i;
 
-error_exit:
-	return retval;
+	if (data->input)
+		size += sizeof(struct input_dev);
+	for (i = 1; i < data->sensor_count; i++)
+		if (data->sensors[i].input)
+			size += sizeof(struct input_dev);
+	if (data->scroll.input)
+		size += sizeof(struct input_dev);
+	for (i = 0; i < RMI_FAULT_REPORTS; i++)
+		if (data->faults[i].held)
+			size += data->input_report_size;
+
+	if (data->hdev)
+		size += RMI_XFER_POOL_SIZE *
+			(ALIGN(data->input_report_size, ARCH_DMA_MINALIGN) +
+			 ALIGN(data->output_report_size, ARCH_DMA_MINALIGN));
+	if (data->attn_frame)
+		size += rmi_attn_frame_size(data);
+	if (data->ring.enabled)
+		size += RMI_RING_SIZE * rmi_attn_frame_size(data);
+	if (data->poll.frame)
+		size += rmi_attn_frame_size(data) + RMI_POLL_MAX_SPAN;
+	if (data->regs_out)
+		size += RMI_REGS_OUT_SIZE;
+	if (data->mock_regs)
+		size += RMI_MOCK_REGS_SIZE;
+
+	return size;
 }
 
-static int rmi_populate_f11(struct hid_device *hdev)
+static void rmi_scale_populate_work(struct work_struct *work)
 {
-	struct rmi_data *data = hid_get_drvdata(hdev);
-	u8 buf[20];
-	int ret;
-	bool has_query9;
-	bool has_query10;
-	bool has_query11;
-	bool has_query12;
-	bool has_physical_props;
-	unsigned x_size, y_size;
-	u16 query12_offset;
+	struct rmi_scale_dev *dev = container_of(work, struct rmi_scale_dev,
+						 work);
+	struct rmi_data *mock = dev->mock;
+	u64 start = ktime_get_ns();
+
+	dev->ret = rmi_populate(mock);
+	dev->populate_ns = ktime_get_ns() - start;
+	if (dev->ret)
+		return;
 
-	if (!data->f11.query_base_addr) {
-		hid_err(hdev, "No 2D sensor found, giving up.\n");
-		return -ENODEV;
-	}
+	rmi_setup_input(mock, mock->input);
+	set_bit(RMI_STARTED, &mock->flags);
 
-	/* query 0 contains some useful information */
-	ret = rmi_read(hdev, data->f11.query_base_addr, buf);
-	if (ret) {
-		hid_err(hdev, "can not get query 0: %d.\n", ret);
-		return ret;
+	dev->frame = kzalloc(rmi_attn_frame_size(mock), GFP_KERNEL);
+	if (!dev->frame) {
+		dev->ret = -ENOMEM;
+		return;
 	}
-	has_query9 = !!(buf[0] & BIT(3));
-	has_query11 = !!(buf[0] & BIT(4));
-	has_query12 = !!(buf[0] & BIT(5));
 
-	/* query 1 to get the max number of fingers */
-	ret = rmi_read(hdev, data->f11.query_base_addr + 1, buf);
-	if (ret) {
-		hid_err(hdev, "can not get NumberOfFingers: %d.\n", ret);
-		return ret;
-	}
-	data->max_fingers = (buf[0] & 0x07) + 1;
-	if (data->max_fingers > 5)
-		data->max_fingers = 10;
+	dev->frame_len = rmi_fetch_attn_frame(mock,
+			mock->f11.irq_mask | mock->f30.irq_mask,
+			dev->frame, rmi_attn_frame_size(mock), NULL, 0, 0);
+	if (dev->frame_len < 0)
+		dev->ret = dev->frame_len;
+}
 
-	data->f11.report_size = data->max_fingers * 5 +
-				DIV_ROUND_UP(data->max_fingers, 4);
+static void rmi_scale_stream_work(struct work_struct *work)
+{
+	struct rmi_scale_dev *dev = container_of(work, struct rmi_scale_dev,
+						 work);
+	u64 start = ktime_get_ns();
+	u64 ts, elapsed;
+	int i;
 
-	if (!(buf[0] & BIT(4))) {
-		hid_err(hdev, "No absolute events, giving up.\n");
-		return -ENODEV;
+	for (i = 0; i < RMI_BENCH_FRAMES; i++) {
+		ts = ktime_get_ns();
+		rmi_attn_dispatch(dev->mock, dev->frame, dev->frame_len, ts);
+		elapsed = ktime_get_ns() - ts;
+		if (elapsed > dev->worst_ns)
+			dev->worst_ns = elapsed;
 	}
+	dev->decode_ns = ktime_get_ns() - start;
+}
 
-	/* query 8 to find out if query 10 exists */
-	ret = rmi_read(hdev, data->f11.query_base_addr + 8, buf);
-	if (ret) {
-		hid_err(hdev, "can not read gesture information: %d.\n", ret);
-		return ret;
+/* runs @func on the first @n devices at once, returns the wall time */
+static u64 rmi_scale_run(struct rmi_scale_dev *devs, int n, work_func_t func)
+{
+	u64 start = ktime_get_ns();
+	int i;
+
+	for (i = 0; i < n; i++) {
+		INIT_WORK(&devs[i].work, func);
+		queue_work(system_unbound_wq, &devs[i].work);
 	}
-	has_query10 = !!(buf[0] & BIT(2));
 
-	/*
-	 * At least 8 queries are guaranteed to be present in F11
-	 * +1 for query12.
-	 */
-	query12_offset = 9;
+	for (i = 0; i < n; i++)
+		flush_work(&devs[i].work);
 
-	if (has_query9)
-		++query12_offset;
+	return ktime_get_ns() - start;
+}
 
-	if (has_query10)
-		++query12_offset;
+static int rmi_scale_step(struct seq_file *s, struct rmi_data *data,
+		struct rmi_scale_dev *devs, int n, u64 *base_ns)
+{
+	unsigned int ideal = min_t(unsigned int, n, num_online_cpus());
+	u64 populate_ns = 0, decode_ns = 0, worst_ns = 0;
+	u64 populate_wall, decode_wall;
+	u64 populate_par, decode_par, slowdown;
+	int ret = 0;
+	int i;
 
-	if (has_query11)
-		++query12_offset;
+	memset(devs, 0, n * sizeof(*devs));
+	for (i = 0; i < n; i++) {
+		devs[i].regs = vmalloc(RMI_MOCK_REGS_SIZE);
+		if (!devs[i].regs) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		memcpy(devs[i].regs, data->mock_regs, RMI_MOCK_REGS_SIZE);
 
-	/* query 12 to know if the physical properties are reported */
-	if (has_query12) {
-		ret = rmi_read(hdev, data->f11.query_base_addr
-				+ query12_offset, buf);
-		if (ret) {
-			hid_err(hdev, "can not get query 12: %d.\n", ret);
-			return ret;
+		devs[i].mock = rmi_mock_alloc(data, devs[i].regs);
+		if (!devs[i].mock) {
+			ret = -ENOMEM;
+			goto out;
 		}
-		has_physical_props = !!(buf[0] & BIT(5));
+	}
 
-		if (has_physical_props) {
-			ret = rmi_read_block(hdev,
-					data->f11.query_base_addr
-						+ query12_offset + 1, buf, 4);
-			if (ret) {
-				hid_err(hdev, "can not read query 15-18: %d.\n",
-					ret);
-				return ret;
-			}
+	populate_wall = rmi_scale_run(devs, n, rmi_scale_populate_work);
+	for (i = 0; i < n; i++) {
+		if (devs[i].ret) {
+			ret = devs[i].ret;
+			goto out;
+		}
+		populate_ns += devs[i].populate_ns;
+	}
 
-			x_size = buf[0] | (buf[1] << 8);
-			y_size = buf[2] | (buf[3] << 8);
+	decode_wall = rmi_scale_run(devs, n, rmi_scale_stream_work);
+	for (i = 0; i < n; i++) {
+		decode_ns += devs[i].decode_ns;
+		worst_ns = max(worst_ns, devs[i].worst_ns);
+	}
 
-			data->x_size_mm = DIV_ROUND_CLOSEST(x_size, 10);
-			data->y_size_mm = DIV_ROUND_CLOSEST(y_size, 10);
+	/* device time per wall time, in %: n * 100 if nothing is shared */
+	populate_par = div64_u64(populate_ns * 100, populate_wall ?: 1);
+	decode_par = div64_u64(decode_ns * 100, decode_wall ?: 1);
+
+	decode_ns = div_u64(decode_ns, n * RMI_BENCH_FRAMES);
+	if (!*base_ns)
+		*base_ns = decode_ns ?: 1;
+	slowdown = div64_u64(decode_ns * 100, *base_ns);
+
+	seq_printf(s, "%d devices:\tmock populate %llu us/device, %llu%% parallel\n",
+		   n, div_u64(populate_ns, n * NSEC_PER_USEC), populate_par);
+	seq_printf(s, "\t\tmock decode %llu ns/frame (worst %llu ns), %llu%% parallel, %llu%% of 1 device\n",
+		   decode_ns, worst_ns, decode_par, slowdown);
+
+	if (populate_par < ideal * 50)
+		seq_puts(s, "\t\tcontended: populate runs serialized\n");
+	if (decode_par < ideal * 50 || slowdown > 150)
+		seq_puts(s, "\t\tcontended: decode slows down with the device count\n");
+
+out:
+	for (i = 0; i < n; i++) {
+		kfree(devs[i].frame);
+		if (devs[i].mock)
+			rmi_mock_free(devs[i].mock);
+		vfree(devs[i].regs);
+	}
+	return ret;
+}
 
-			hid_info(hdev, "%s: size in mm: %d x %d\n",
-				 __func__, data->x_size_mm, data->y_size_mm);
-		}
+static int rmi_debugfs_scale_show(struct seq_file *s, void *unused)
+{
+	struct rmi_data *data = s->private;
+	unsigned int max = data->scale_devices ?: RMI_SCALE_DEVICES;
+	struct rmi_scale_dev *devs;
+	u64 base_ns = 0;
+	int ret = 0;
+	int n;
+
+	/* the image is copied for every step, keep it from being rewritten */
+	mutex_lock(&data->regs_mutex);
+
+	if (!data->mock_regs) {
+		ret = rmi_transport_get(data);
+		if (ret)
+			goto unlock;
+		ret = rmi_mock_snapshot(data);
+		rmi_transport_put(data);
+		if (ret)
+			goto unlock;
 	}
 
-	/* retrieve the ctrl registers */
-	ret = rmi_read_block(hdev, data->f11.control_base_addr, buf, 20);
-	if (ret) {
-		hid_err(hdev, "can not read ctrl block of size 20: %d.\n", ret);
-		return ret;
+	devs = kcalloc(max, sizeof(*devs), GFP_KERNEL);
+	if (!devs) {
+		ret = -ENOMEM;
+		goto unlock;
 	}
 
-	data->max_x = buf[6] | (buf[7] << 8);
-	data->max_y = buf[8] | (buf[9] << 8);
+	seq_printf(s, "cpus:\t\t%u\n", num_online_cpus());
+	seq_printf(s, "estimated footprint:\t~%zu bytes/device (+%d bytes per mock image)\n",
+		   rmi_footprint(data), RMI_MOCK_REGS_SIZE);
 
-	return 0;
+	for (n = 1; ; n = min_t(unsigned int, n * 2, max)) {
+		ret = rmi_scale_step(s, data, devs, n, &base_ns);
+		if (ret || n == max)
+			break;
+	}
+
+	kfree(devs);
+unlock:
+	mutex_unlock(&data->regs_mutex);
+	return ret;
 }
 
-static int rmi_populate_f30(struct hid_device *hdev)
+static int rmi_debugfs_scale_open(struct inode *inode, struct file *file)
 {
-	struct rmi_data *data = hid_get_drvdata(hdev);
-	u8 buf[20];
-	int ret;
-	bool has_gpio, has_led;
-	unsigned bytes_per_ctrl;
-	u8 ctrl2_addr;
-	int ctrl2_3_length;
-	int i;
+	return single_open(file, rmi_debugfs_scale_show, inode->i_private);
+}
 
-	/* function F30 is for physical buttons */
-	if (!data->f30.query_base_addr) {
-		hid_err(hdev, "No GPIO/LEDs found, giving up.\n");
-		return -ENODEV;
-	}
+static ssize_t rmi_debugfs_scale_write(struct file *file,
+		const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct rmi_data *data = s->private;
+	unsigned int devices;
+	int ret;
 
-	ret = rmi_read_block(hdev, data->f30.query_base_addr, buf, 2);
-	if (ret) {
-		hid_err(hdev, "can not get F30 query registers: %d.\n", ret);
+	ret = kstrtouint_from_user(ubuf, count, 0, &devices);
+	if (ret)
 		return ret;
-	}
 
-	has_gpio = !!(buf[0] & BIT(3));
-	has_led = !!(buf[0] & BIT(2));
-	data->gpio_led_count = buf[1] & 0x1f;
+	if (!devices || devices > RMI_SCALE_MAX_DEVICES)
+		return -EINVAL;
 
-	/* retrieve ctrl 2 & 3 registers */
-	bytes_per_ctrl = (data->gpio_led_count + 7) / 8;
-	/* Ctrl0 is present only if both has_gpio and has_led are set*/
-	ctrl2_addr = (has_gpio && has_led) ? bytes_per_ctrl : 0;
-	/* Ctrl1 is always be present */
-	ctrl2_addr += bytes_per_ctrl;
-	ctrl2_3_length = 2 * bytes_per_ctrl;
+	data->scale_devices = devices;
+	return count;
+}
 
-	data->f30.report_size = bytes_per_ctrl;
+static const struct file_operations rmi_debugfs_scale_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rmi_debugfs_scale_open,
+	.read		= seq_read,
+	.write		= rmi_debugfs_scale_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
 
-	ret = rmi_read_block(hdev, data->f30.control_base_addr + ctrl2_addr,
-				buf, ctrl2_3_length);
-	if (ret) {
-		hid_err(hdev, "can not read ctrl 2&3 block of size %d: %d.\n",
-			ctrl2_3_length, ret);
-		return ret;
-	}
+/*
+ * debugfs: fault injection in the HID input reports.
+ *
+ * Every command written to "faults" sets the probability of one fault on
+ * one report type, "<read|attn> <drop|truncate|delay|reset> <percent>
+ * [delay ms]", or "clear" removes them all. Only attention reports can be
+ * turned into a reset. A write starts a new profile: reading the file then
+ * shows what was injected since, the frames lost, and how long the read
+ * retries and the resets took to get the device back.
+ */
 
-	for (i = 0; i < data->gpio_led_count; i++) {
-		int byte_position = i >> 3;
-		int bit_position = i & 0x07;
-		u8 dir_byte = buf[byte_position];
-		u8 data_byte = buf[byte_position + bytes_per_ctrl];
-		bool dir = (dir_byte >> bit_position) & BIT(0);
-		bool dat = (data_byte >> bit_position) & BIT(0);
+#define RMI_FAULT_DELAY_MS		50
+#define RMI_FAULT_MAX_DELAY_MS		5000
+
+static const char * const rmi_fault_names[RMI_FAULT_REPORTS] = {
+	[RMI_FAULT_READ] = "read",
+	[RMI_FAULT_ATTN] = "attn",
+};
+
+static int rmi_fault_command(struct rmi_data *data, char *cmd)
+{
+	char *type = strsep(&cmd, " \t");
+	struct rmi_fault *fault;
+	unsigned int percent, delay_ms, *field;
+	char *kind, *arg;
+	int i;
+
+	if (!*type)
+		return 0;
 
-		if (dir == 0) {
-			/* input mode */
-			if (dat) {
-				/* actual buttons have pull up resistor */
-				data->button_count++;
-				set_bit(i, &data->button_mask);
-				set_bit(i, &data->button_state_mask);
-			}
+	if (!strcmp(type, "clear")) {
+		for (i = 0; i < RMI_FAULT_REPORTS; i++) {
+			fault = &data->faults[i];
+			fault->drop = 0;
+			fault->truncate = 0;
+			fault->delay = 0;
+			fault->reset = 0;
 		}
+		return 0;
+	}
 
+	for (i = 0; i < RMI_FAULT_REPORTS; i++)
+		if (!strcmp(type, rmi_fault_names[i]))
+			break;
+	if (i == RMI_FAULT_REPORTS)
+		return -EINVAL;
+	fault = &data->faults[i];
+
+	kind = strsep(&cmd, " \t");
+	arg = strsep(&cmd, " \t");
+	if (!kind || !arg || kstrtouint(arg, 0, &percent) || percent > 100)
+		return -EINVAL;
+
+	if (!strcmp(kind, "drop"))
+		field = &fault->drop;
+	else if (!strcmp(kind, "truncate"))
+		field = &fault->truncate;
+	else if (!strcmp(kind, "delay"))
+		field = &fault->delay;
+	else if (!strcmp(kind, "reset") && i == RMI_FAULT_ATTN)
+		field = &fault->reset;
+	else
+		return -EINVAL;
+
+	if (fault->drop + fault->truncate + fault->delay + fault->reset -
+	    *field + percent > 100)
+		return -EINVAL;
+
+	if (field == &fault->delay) {
+		delay_ms = RMI_FAULT_DELAY_MS;
+		arg = strsep(&cmd, " \t");
+		if (arg && (kstrtouint(arg, 0, &delay_ms) ||
+			    delay_ms > RMI_FAULT_MAX_DELAY_MS))
+			return -EINVAL;
+
+		if (!fault->held) {
+			fault->held = devm_kzalloc(data->dev,
+					data->input_report_size, GFP_KERNEL);
+			if (!fault->held)
+				return -ENOMEM;
+		}
+		fault->delay_ms = delay_ms;
 	}
 
+	*field = percent;
 	return 0;
 }
 
-static int rmi_populate(struct hid_device *hdev)
+static void rmi_fault_profile_start(struct rmi_data *data)
 {
-	int ret;
-
-	ret = rmi_scan_pdt(hdev);
-	if (ret) {
-		hid_err(hdev, "PDT scan failed with code %d.\n", ret);
-		return ret;
-	}
+	struct rmi_recovery_stats *stats = &data->recovery_stats;
+	struct rmi_fault *fault;
+	bool armed = false;
+	int i;
 
-	ret = rmi_populate_f11(hdev);
-	if (ret) {
-		hid_err(hdev, "Error while initializing F11 (%d).\n", ret);
-		return ret;
+	for (i = 0; i < RMI_FAULT_REPORTS; i++) {
+		fault = &data->faults[i];
+		memset(&fault->stats, 0, sizeof(fault->stats));
+		armed |= fault->drop || fault->truncate || fault->delay ||
+			 fault->reset;
 	}
 
-	ret = rmi_populate_f30(hdev);
-	if (ret)
-		hid_warn(hdev, "Error while initializing F30 (%d).\n", ret);
+	memset(stats, 0, sizeof(*stats));
+	stats->base_frames = data->attn_stats.frames;
+	stats->base_short = data->attn_stats.short_frames;
+	stats->base_incomplete = data->attn_stats.incomplete_frames;
 
-	return 0;
+	WRITE_ONCE(data->faults_armed, armed);
 }
 
-static void rmi_input_configured(struct hid_device *hdev, struct hid_input *hi)
+static int rmi_debugfs_faults_show(struct seq_file *s, void *unused)
 {
-	struct rmi_data *data = hid_get_drvdata(hdev);
-	struct input_dev *input = hi->input;
-	int ret;
-	int res_x, res_y, i;
+	struct rmi_data *data = s->private;
+	struct rmi_recovery_stats stats = data->recovery_stats;
+	struct rmi_attn_stats *attn = &data->attn_stats;
+	struct rmi_fault *fault;
+	int i;
 
-	data->input = input;
+	if (!data->hdev)
+		return -EOPNOTSUPP;
+
+	for (i = 0; i < RMI_FAULT_REPORTS; i++) {
+		fault = &data->faults[i];
+		seq_printf(s, "%s:\t\tdrop %u%%, truncate %u%%, delay %u%% (%u ms), reset %u%%\n",
+			   rmi_fault_names[i], fault->drop, fault->truncate,
+			   fault->delay, fault->delay_ms, fault->reset);
+		seq_printf(s, "\t\t%llu reports: %llu dropped, %llu truncated, %llu delayed, %llu resets\n",
+			   fault->stats.reports, fault->stats.dropped,
+			   fault->stats.truncated, fault->stats.delayed,
+			   fault->stats.resets);
+	}
 
-	hid_info(hdev, "Opening low level driver\n");
-	ret = hid_hw_open(hdev);
-	if (ret)
-		return;
+	seq_printf(s, "frames:\t\t%llu decoded, %llu short, %llu incomplete\n",
+		   attn->frames - stats.base_frames,
+		   attn->short_frames - stats.base_short,
+		   attn->incomplete_frames - stats.base_incomplete);
+	seq_printf(s, "read retries:\t%llu\n", stats.read_retries);
+	seq_printf(s, "read recovery:\t%llu us (max %llu us, %llu recovered, %llu failed)\n",
+		   div_u64(div64_u64(stats.read_recover_ns,
+				     stats.read_recoveries ?: 1),
+			   NSEC_PER_USEC),
+		   div_u64(stats.read_recover_max_ns, NSEC_PER_USEC),
+		   stats.read_recoveries, stats.read_failures);
+	seq_printf(s, "reset recovery:\t%llu us (max %llu us, %llu resets)\n",
+		   div_u64(div64_u64(stats.reset_ns, stats.resets ?: 1),
+			   NSEC_PER_USEC),
+		   div_u64(stats.reset_max_ns, NSEC_PER_USEC), stats.resets);
 
-	/* Allow incoming hid reports */
-	hid_device_io_start(hdev);
+	return 0;
+}
 
-	ret = rmi_set_mode(hdev, RMI_MODE_ATTN_REPORTS);
-	if (ret < 0) {
-		dev_err(&hdev->dev, "failed to set rmi mode\n");
-		goto exit;
-	}
+static int rmi_debugfs_faults_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rmi_debugfs_faults_show, inode->i_private);
+}
 
-	ret = rmi_set_page(hdev, 0);
-	if (ret < 0) {
-		dev_err(&hdev->dev, "failed to set page select to 0.\n");
-		goto exit;
+static ssize_t rmi_debugfs_faults_write(struct file *file,
+		const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct rmi_data *data = s->private;
+	char *cmds, *cur, *cmd;
+	int ret = 0;
+
+	if (!data->hdev)
+		return -EOPNOTSUPP;
+
+	if (count > PAGE_SIZE)
+		return -E2BIG;
+
+	cmds = memdup_user_nul(ubuf, count);
+	if (IS_ERR(cmds))
+		return PTR_ERR(cmds);
+
+	mutex_lock(&data->regs_mutex);
+	cur = cmds;
+	while ((cmd = strsep(&cur, "\n;"))) {
+		ret = rmi_fault_command(data, strim(cmd));
+		if (ret)
+			break;
 	}
+	rmi_fault_profile_start(data);
+	mutex_unlock(&data->regs_mutex);
 
-	ret = rmi_populate(hdev);
-	if (ret)
-		goto exit;
-
-	__set_bit(EV_ABS, input->evbit);
-	input_set_abs_params(input, ABS_MT_POSITION_X, 1, data->max_x, 0, 0);
-	input_set_abs_params(input, ABS_MT_POSITION_Y, 1, data->max_y, 0, 0);
+	kfree(cmds);
+	return ret ? ret : count;
+}
 
-	if (data->x_size_mm && data->y_size_mm) {
-		res_x = (data->max_x - 1) / data->x_size_mm;
-		res_y = (data->max_y - 1) / data->y_size_mm;
+static const struct file_operations rmi_debugfs_faults_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rmi_debugfs_faults_open,
+	.read		= seq_read,
+	.write		= rmi_debugfs_faults_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
 
-		input_abs_set_res(input, ABS_MT_POSITION_X, res_x);
-		input_abs_set_res(input, ABS_MT_POSITION_Y, res_y);
+static int rmi_debugfs_poll_stats_show(struct seq_file *s, void *unused)
+{
+	struct rmi_data *data = s->private;
+	struct rmi_poll *poll = &data->poll;
+	struct rmi_poll_stats stats = poll->stats;
+	int report_size = data->hdev ? data->input_report_size :
+			rmi_attn_frame_size(data);
+
+	if (!poll->enabled) {
+		seq_puts(s, "disabled\n");
+		return 0;
 	}
 
-	input_set_abs_params(input, ABS_MT_ORIENTATION, 0, 1, 0, 0);
-	input_set_abs_params(input, ABS_MT_PRESSURE, 0, 0xff, 0, 0);
-	input_set_abs_params(input, ABS_MT_TOUCH_MAJOR, 0, 0x0f, 0, 0);
-	input_set_abs_params(input, ABS_MT_TOUCH_MINOR, 0, 0x0f, 0, 0);
+	seq_printf(s, "mode:\t\t%s\n", poll->active ? "polling" : "attention");
+	seq_printf(s, "span:\t\t%#06x, %d bytes\n", poll->span_base,
+		   poll->span_len);
+	seq_printf(s, "attention:\t%llu ms, %llu frames, %llu bytes\n",
+		   div_u64(stats.attn_ns, NSEC_PER_MSEC), stats.attn_frames,
+		   stats.attn_frames * report_size);
+	seq_printf(s, "watchdog:\t%llu reads, %llu bytes\n",
+		   stats.watch_reads, stats.watch_bytes);
+	seq_printf(s, "polling:\t%llu ms, %llu ticks, %llu frames, %llu bytes\n",
+		   div_u64(stats.poll_ns, NSEC_PER_MSEC), stats.ticks,
+		   stats.frames, stats.bytes);
+	seq_printf(s, "poll bus time:\t%llu us/tick\n",
+		   div64_u64(div_u64(stats.bus_ns, NSEC_PER_USEC),
+			     stats.ticks ?: 1));
+	seq_printf(s, "switches:\t%llu to polling, %llu to attention\n",
+		   stats.to_poll, stats.to_attn);
+
+	return 0;
+}
 
-	input_mt_init_slots(input, data->max_fingers, INPUT_MT_POINTER);
+static int rmi_debugfs_poll_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rmi_debugfs_poll_stats_show, inode->i_private);
+}
 
-	if (data->button_count) {
-		__set_bit(EV_KEY, input->evbit);
-		for (i = 0; i < data->button_count; i++)
-			__set_bit(BTN_LEFT + i, input->keybit);
+static const struct file_operations rmi_debugfs_poll_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rmi_debugfs_poll_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
 
-		if (data->button_count == 1)
-			__set_bit(INPUT_PROP_BUTTONPAD, input->propbit);
+static int rmi_debugfs_trace_show(struct seq_file *s, void *unused)
+{
+	static const char * const names[] = {
+		[RMI_TRACE_READ]	= "read",
+		[RMI_TRACE_WRITE]	= "write",
+		[RMI_TRACE_PAGE]	= "page",
+		[RMI_TRACE_OUT]		= "out",
+		[RMI_TRACE_IN]		= "in",
+		[RMI_TRACE_TIMEOUT]	= "timeout",
+	};
+	struct rmi_data *data = s->private;
+	unsigned int head = atomic_read(&data->trace_head);
+	unsigned int i = head > RMI_TRACE_SIZE ? head - RMI_TRACE_SIZE : 0;
+	struct rmi_trace_entry e;
+	u32 rem;
+	u64 sec;
+
+	/* oldest first, CLOCK_MONOTONIC like ktime_get_ns() */
+	for (; i != head; i++) {
+		e = data->trace[i & (RMI_TRACE_SIZE - 1)];
+		sec = div_u64_rem(e.ts, NSEC_PER_SEC, &rem);
+		seq_printf(s, "[%5llu.%06u] %-7s id %#04x addr %#06x len %-4u ret %d\n",
+			   sec, rem / 1000,
+			   e.type < ARRAY_SIZE(names) ? names[e.type] : "?",
+			   e.report_id, e.addr, e.len, e.result);
 	}
 
-	hid_info(hdev, "Got data about trackpad: %i buttons, supports %i fingers.", data->button_count, data->max_fingers);
+	return 0;
+}
 
-	set_bit(RMI_STARTED, &data->flags);
+static int rmi_debugfs_trace_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rmi_debugfs_trace_show, inode->i_private);
+}
 
-exit:
-	hid_device_io_stop(hdev);
-	hid_hw_close(hdev);
+static const struct file_operations rmi_debugfs_trace_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rmi_debugfs_trace_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void rmi_debugfs_init(struct rmi_data *data)
+{
+	mutex_init(&data->regs_mutex);
+
+	data->debugfs = debugfs_create_dir(dev_name(data->dev),
+			rmi_debugfs_root);
+
+	debugfs_create_file("mock_image", S_IWUSR, data->debugfs, data,
+			&rmi_debugfs_mock_fops);
+	debugfs_create_file("bench", S_IRUSR, data->debugfs, data,
+			&rmi_debugfs_bench_fops);
+	debugfs_create_file("xfer_stats", S_IRUSR, data->debugfs, data,
+			&rmi_debugfs_xfer_stats_fops);
+	debugfs_create_file("attn_layout", S_IRUGO, data->debugfs, data,
+			&rmi_debugfs_attn_layout_fops);
+	debugfs_create_file("attn_stats", S_IRUSR, data->debugfs, data,
+			&rmi_debugfs_attn_stats_fops);
+	debugfs_create_file("pm_stats", S_IRUSR, data->debugfs, data,
+			&rmi_debugfs_pm_stats_fops);
+	debugfs_create_file("rate_stats", S_IRUSR, data->debugfs, data,
+			&rmi_debugfs_rate_stats_fops);
+	debugfs_create_file("trace", S_IRUSR, data->debugfs, data,
+			&rmi_debugfs_trace_fops);
+	debugfs_create_file("poll_stats", S_IRUSR, data->debugfs, data,
+			&rmi_debugfs_poll_stats_fops);
+	debugfs_create_file("regs", S_IRUSR | S_IWUSR, data->debugfs, data,
+			&rmi_debugfs_regs_fops);
+	debugfs_create_file("reflash", S_IRUSR | S_IWUSR, data->debugfs, data,
+			&rmi_debugfs_reflash_fops);
+	debugfs_create_file("profile", S_IRUSR | S_IWUSR, data->debugfs, data,
+			&rmi_debugfs_profile_fops);
+	debugfs_create_file("scale", S_IRUSR | S_IWUSR, data->debugfs, data,
+			&rmi_debugfs_scale_fops);
+	debugfs_create_file("faults", S_IRUSR | S_IWUSR, data->debugfs, data,
+			&rmi_debugfs_faults_fops);
 }
 
-static int rmi_input_mapping(struct hid_device *hdev,
-		struct hid_input *hi, struct hid_field *field,
-		struct hid_usage *usage, unsigned long **bit, int *max)
+static void rmi_debugfs_exit(struct rmi_data *data)
 {
-	/* we want to make HID ignore the advertised HID collection */
-	return -1;
+	debugfs_remove_recursive(data->debugfs);
+	data->debugfs = NULL;
+	vfree(data->mock_regs);
+	data->mock_regs = NULL;
+	vfree(data->regs_out);
+	data->regs_out = NULL;
 }
 
 static int rmi_probe(struct hid_device *hdev, const struct hid_device_id *id)
 {
 	struct rmi_data *data = NULL;
 	int ret;
-	size_t alloc_size;
+	u64 start = ktime_get_ns();
+	int i;
 
 	data = devm_kzalloc(&hdev->dev, sizeof(struct rmi_data), GFP_KERNEL);
 	if (!data)
 		return -ENOMEM;
 
 	INIT_WORK(&data->reset_work, rmi_reset_work);
+	INIT_WORK(&data->ring.work, rmi_ring_work);
+	spin_lock_init(&data->attn_lock);
+	hrtimer_setup(&data->attn_timer, rmi_attn_expire, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL);
+	spin_lock_init(&data->event_lock);
+	for (i = 0; i < RMI_FAULT_REPORTS; i++) {
+		data->faults[i].data = data;
+		INIT_DELAYED_WORK(&data->faults[i].work, rmi_fault_work);
+	}
 	data->hdev = hdev;
+	data->dev = &hdev->dev;
+	data->xport = &rmi_hid_ops;
 
 	hid_set_drvdata(hdev, data);
 
@@ -865,41 +6320,75 @@ static int rmi_probe(struct hid_device *hdev, const struct hid_device_id *id)
 		.report_id_hash[RMI_WRITE_REPORT_ID]->size >> 3)
 		+ 1 /* report id */;
 
-	alloc_size = data->output_report_size + data->input_report_size;
+	/* report id, length and 16 bits address come first */
+	data->max_write_size = data->output_report_size - 4;
 
-	data->writeReport = devm_kzalloc(&hdev->dev, alloc_size, GFP_KERNEL);
-	if (!data->writeReport) {
-		ret = -ENOMEM;
+	ret = rmi_xfer_pool_init(data);
+	if (ret)
 		return ret;
-	}
 
-	data->readReport = data->writeReport + data->output_report_size;
+	rmi_xfer_init(data);
+	spin_lock_init(&data->poll.lock);
+	ratelimit_state_init(&data->event_rs, RMI_EVENT_LOG_INTERVAL, 1);
+	ratelimit_set_flags(&data->event_rs, RATELIMIT_MSG_ON_RELEASE);
 
-	init_waitqueue_head(&data->wait);
-
-	mutex_init(&data->page_mutex);
+	rmi_debugfs_init(data);
 
 	ret = hid_hw_start(hdev, HID_CONNECT_DEFAULT);
 	if (ret) {
 		hid_err(hdev, "hw start failed\n");
+		rmi_debugfs_exit(data);
 		return ret;
 	}
 
 	if (!test_bit(RMI_STARTED, &data->flags)) {
 		hid_hw_stop(hdev);
+		hrtimer_cancel(&data->attn_timer);
+		rmi_debugfs_exit(data);
 		return -EIO;
 	}
 
+	data->probe_ns = ktime_get_ns() - start;
+	hid_info(hdev, "probed in %llu us\n", div_u64(data->probe_ns,
+			NSEC_PER_USEC));
+
 	return 0;
 }
 
 static void rmi_remove(struct hid_device *hdev)
 {
 	struct rmi_data *hdata = hid_get_drvdata(hdev);
+	u64 start = ktime_get_ns();
+	int i;
 
+	rmi_xfer_set_state(hdata, RMI_XFER_DYING);
 	clear_bit(RMI_STARTED, &hdata->flags);
 
+	/* no fault profile can be written past this point */
+	rmi_debugfs_exit(hdata);
+
+	/*
+	 * The transport keeps delivering reports until hid_hw_stop(), and a
+	 * report already past the checks may still queue a reset, a replay
+	 * or a frame to decode. Reports run under event_lock: taking it
+	 * waits for the one in flight, and the next ones see the device
+	 * dying, not started and the faults disarmed, and queue nothing. The
+	 * works are cancelled for good after that.
+	 */
+	WRITE_ONCE(hdata->faults_armed, false);
+	spin_lock_irq(&hdata->event_lock);
+	spin_unlock_irq(&hdata->event_lock);
+	for (i = 0; i < RMI_FAULT_REPORTS; i++)
+		cancel_delayed_work_sync(&hdata->faults[i].work);
+	cancel_work_sync(&hdata->reset_work);
+	rmi_workers_stop(hdata);
+	cancel_work_sync(&hdata->ring.work);
+
 	hid_hw_stop(hdev);
+	hrtimer_cancel(&hdata->attn_timer);
+
+	dev_dbg(&hdev->dev, "removed in %llu us\n",
+		div_u64(ktime_get_ns() - start, NSEC_PER_USEC));
 }
 
 static const struct hid_device_id rmi_id[] = {
@@ -918,12 +6407,354 @@ static struct hid_driver rmi_driver = {
 	.input_mapping		= rmi_input_mapping,
 	.input_configured	= rmi_input_configured,
 #ifdef CONFIG_PM
+	.suspend		= rmi_hid_suspend,
 	.resume			= rmi_post_resume,
 	.reset_resume		= rmi_post_reset,
 #endif
 };
 
-module_hid_driver(rmi_driver);
+#if IS_ENABLED(CONFIG_I2C)
+static irqreturn_t rmi_i2c_irq(int irq, void *dev_id)
+{
+	struct rmi_data *data = dev_id;
+	unsigned long flags;
+	u8 status[4];
+	int len;
+	int ret;
+
+	/* reading the interrupt status registers acknowledges them */
+	ret = rmi_read_block(data, data->f01.data_base_addr + 1, status,
+			min_t(int, DIV_ROUND_UP(data->irq_count, 8),
+			      sizeof(status)));
+	if (ret == -ESHUTDOWN) {
+		/*
+		 * Suspending, resuming or going away: the status can not be
+		 * read, so the line stays asserted. It is masked until resume,
+		 * which then reads the frame (the wake event if armed).
+		 */
+		disable_irq_nosync(irq);
+		set_bit(RMI_ATTN_DEFERRED, &data->flags);
+		smp_mb__after_atomic();
+		if (!rmi_xfer_rejected(data) &&
+		    test_and_clear_bit(RMI_ATTN_DEFERRED, &data->flags))
+			enable_irq(irq);
+		return IRQ_HANDLED;
+	}
+	if (ret)
+		return IRQ_NONE;
+
+	if (!status[0])
+		return IRQ_NONE;
+
+	rmi_poll_attention(data);
+
+	len = rmi_fetch_attn_frame(data, status[0], data->attn_frame,
+			rmi_attn_frame_size(data), NULL, 0, 0);
+	if (len > 0) {
+		spin_lock_irqsave(&data->poll.lock, flags);
+		rmi_input_event(data, data->attn_frame, len);
+		spin_unlock_irqrestore(&data->poll.lock, flags);
+	}
+
+	return IRQ_HANDLED;
+}
+
+static int rmi_i2c_input_open(struct input_dev *input)
+{
+	return rmi_open(input_get_drvdata(input));
+}
+
+static void rmi_i2c_input_close(struct input_dev *input)
+{
+	rmi_close(input_get_drvdata(input));
+}
+
+static int rmi_i2c_probe(struct i2c_client *client)
+{
+	struct rmi_data *data;
+	struct input_dev *input;
+	int ret;
+	u64 start = ktime_get_ns();
+
+	if (!i2c_check_functionality(client->adapter, I2C_FUNC_I2C) &&
+	    !i2c_check_functionality(client->adapter,
+				     I2C_FUNC_SMBUS_I2C_BLOCK)) {
+		dev_err(&client->dev, "adapter can not do block transfers\n");
+		return -ENODEV;
+	}
+
+	data = devm_kzalloc(&client->dev, sizeof(struct rmi_data), GFP_KERNEL);
+	if (!data)
+		return -ENOMEM;
+
+	INIT_WORK(&data->reset_work, rmi_reset_work);
+	data->dev = &client->dev;
+	data->xport = &rmi_i2c_ops;
+	data->xport_priv = client;
+	data->max_write_size = RMI_I2C_MAX_WRITE;
+
+	i2c_set_clientdata(client, data);
+
+	rmi_xfer_init(data);
+	spin_lock_init(&data->poll.lock);
+	ratelimit_state_init(&data->event_rs, RMI_EVENT_LOG_INTERVAL, 1);
+	ratelimit_set_flags(&data->event_rs, RATELIMIT_MSG_ON_RELEASE);
+
+	ret = rmi_set_page(data, 0);
+	if (ret < 0) {
+		dev_err(&client->dev, "failed to set page select to 0.\n");
+		return ret;
+	}
+
+	data->populate_ns = ktime_get_ns();
+	ret = rmi_populate(data);
+	if (ret)
+		return ret;
+	data->populate_ns = ktime_get_ns() - data->populate_ns;
+
+	if (!data->f01.data_base_addr) {
+		dev_err(&client->dev, "No F01 found, giving up.\n");
+		return -ENODEV;
+	}
+
+	data->attn_frame = devm_kzalloc(&client->dev,
+			rmi_attn_frame_size(data), GFP_KERNEL);
+	input = devm_input_allocate_device(&client->dev);
+	if (!data->attn_frame || !input)
+		return -ENOMEM;
+
+	input->name = "Synaptics RMI4 I2C TouchPad";
+	input->id.bustype = BUS_I2C;
+	input->id.vendor = USB_VENDOR_ID_SYNAPTICS;
+	input->open = rmi_i2c_input_open;
+	input->close = rmi_i2c_input_close;
+	input_set_drvdata(input, data);
+	data->input = input;
+	rmi_setup_input(data, input);
+
+	/* nobody listens yet */
+	rmi_f01_set_sleep(data, RMI_F01_CTRL0_SLEEP_SENSOR);
+
+	ret = input_register_device(input);
+	if (ret)
+		return ret;
+
+	ret = rmi_sensors_init(data, input->name);
+	if (ret)
+		dev_warn(&client->dev, "can not register the sensor devices: %d\n",
+			 ret);
+
+	ret = rmi_scroll_init(data, input->name);
+	if (ret)
+		dev_warn(&client->dev, "can not register the scroll device: %d\n",
+			 ret);
+
+	rmi_rate_init(data);
+	rmi_poll_init(data);
+
+	rmi_debugfs_init(data);
+
+	set_bit(RMI_STARTED, &data->flags);
+
+	if (client->irq > 0) {
+		ret = devm_request_threaded_irq(&client->dev, client->irq,
+				NULL, rmi_i2c_irq, IRQF_ONESHOT,
+				client->name, data);
+		if (ret) {
+			dev_err(&client->dev, "can not get irq %d: %d\n",
+				client->irq, ret);
+			clear_bit(RMI_STARTED, &data->flags);
+			rmi_debugfs_exit(data);
+			return ret;
+		}
+	} else {
+		dev_warn(&client->dev, "no irq, attention is not reported\n");
+	}
+
+	pm_runtime_set_active(&client->dev);
+	pm_runtime_set_autosuspend_delay(&client->dev, autosuspend_ms);
+	pm_runtime_use_autosuspend(&client->dev);
+	pm_runtime_get_noresume(&client->dev);
+	ret = devm_pm_runtime_enable(&client->dev);
+	if (ret) {
+		clear_bit(RMI_STARTED, &data->flags);
+		rmi_debugfs_exit(data);
+		return ret;
+	}
+	pm_runtime_put_autosuspend(&client->dev);
+
+	data->probe_ns = ktime_get_ns() - start;
+	dev_info(&client->dev,
+		 "%i buttons, %i fingers, probed in %llu us\n",
+		 data->button_count, data->sensors[0].max_fingers,
+		 div_u64(data->probe_ns, NSEC_PER_USEC));
+
+	return 0;
+}
+
+static void rmi_i2c_remove(struct i2c_client *client)
+{
+	struct rmi_data *data = i2c_get_clientdata(client);
+	u64 start = ktime_get_ns();
+
+	if (client->irq > 0)
+		disable_irq(client->irq);
+
+	rmi_xfer_set_state(data, RMI_XFER_DYING);
+	clear_bit(RMI_STARTED, &data->flags);
+	cancel_work_sync(&data->reset_work);
+	rmi_workers_stop(data);
+
+	rmi_debugfs_exit(data);
+
+	dev_dbg(&client->dev, "removed in %llu us\n",
+		div_u64(ktime_get_ns() - start, NSEC_PER_USEC));
+}
+
+static int rmi_i2c_runtime_suspend(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+
+	if (client->irq > 0)
+		disable_irq(client->irq);
+
+	return 0;
+}
+
+static int rmi_i2c_runtime_resume(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+
+	if (client->irq > 0)
+		enable_irq(client->irq);
+
+	return 0;
+}
+
+static int rmi_i2c_suspend(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct rmi_data *data = i2c_get_clientdata(client);
+	int ret;
+
+	data->wake_dev = client->irq > 0 && device_may_wakeup(dev) ?
+			 dev : NULL;
+	ret = rmi_suspend(data, data->wake_dev ? RMI_SUSPEND_WAKE :
+						 RMI_SUSPEND_SLEEP);
+
+	if (client->irq <= 0 || pm_runtime_status_suspended(dev))
+		return ret;
+
+	if (test_bit(RMI_WAKE_ARMED, &data->flags))
+		enable_irq_wake(client->irq);
+	else
+		disable_irq(client->irq);
+
+	return ret;
+}
+
+static int rmi_i2c_resume(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct rmi_data *data = i2c_get_clientdata(client);
+	int ret;
+
+	if (client->irq > 0 && !pm_runtime_status_suspended(dev)) {
+		if (test_bit(RMI_WAKE_ARMED, &data->flags))
+			disable_irq_wake(client->irq);
+		else
+			enable_irq(client->irq);
+	}
+
+	ret = rmi_resume(data, false);
+
+	/* an attention masked while quiesced, see rmi_i2c_irq() */
+	if (test_and_clear_bit(RMI_ATTN_DEFERRED, &data->flags))
+		enable_irq(client->irq);
+
+	return ret;
+}
+
+static const struct dev_pm_ops rmi_i2c_pm_ops = {
+	SET_SYSTEM_SLEEP_PM_OPS(rmi_i2c_suspend, rmi_i2c_resume)
+	SET_RUNTIME_PM_OPS(rmi_i2c_runtime_suspend, rmi_i2c_runtime_resume,
+			   NULL)
+};
+
+static const struct i2c_device_id rmi_i2c_id[] = {
+	{ "rmi-i2c", 0 },
+	{ }
+};
+MODULE_DEVICE_TABLE(i2c, rmi_i2c_id);
+
+static struct i2c_driver rmi_i2c_driver = {
+	.driver = {
+		.name	= "rmi-i2c",
+		.pm	= &rmi_i2c_pm_ops,
+	},
+	.probe		= rmi_i2c_probe,
+	.remove		= rmi_i2c_remove,
+	.id_table	= rmi_i2c_id,
+};
+
+static inline int rmi_i2c_register(void)
+{
+	return i2c_add_driver(&rmi_i2c_driver);
+}
+
+static inline void rmi_i2c_unregister(void)
+{
+	i2c_del_driver(&rmi_i2c_driver);
+}
+#else
+static inline int rmi_i2c_register(void)
+{
+	return 0;
+}
+
+static inline void rmi_i2c_unregister(void)
+{
+}
+#endif /* CONFIG_I2C */
+
+static int __init rmi_init(void)
+{
+	int ret;
+
+	rmi_wq = alloc_workqueue("hid-rmi", WQ_UNBOUND, 0);
+	if (!rmi_wq)
+		return -ENOMEM;
+
+	rmi_debugfs_root = debugfs_create_dir("hid-rmi", NULL);
+
+	ret = hid_register_driver(&rmi_driver);
+	if (ret)
+		goto err_debugfs;
+
+	ret = rmi_i2c_register();
+	if (ret)
+		goto err_hid;
+
+	return 0;
+
+err_hid:
+	hid_unregister_driver(&rmi_driver);
+err_debugfs:
+	debugfs_remove_recursive(rmi_debugfs_root);
+	destroy_workqueue(rmi_wq);
+	return ret;
+}
+
+static void __exit rmi_exit(void)
+{
+	rmi_i2c_unregister();
+	hid_unregister_driver(&rmi_driver);
+	debugfs_remove_recursive(rmi_debugfs_root);
+	destroy_workqueue(rmi_wq);
+}
+
+module_init(rmi_init);
+module_exit(rmi_exit);
 
 MODULE_AUTHOR("Andrew Duggan <aduggan@synaptics.com>, Charlie Bruce <charliebruce@gmail.com>");
 MODULE_DESCRIPTION("RMI HID driver for RB");
@@ -1,10 +1,9 @@
 #!/bin/bash
 MODULE=$1
-BLACKLIST_MODULE=$2
 
-UDEV_RULE=/etc/udev/rules.d/99-${MODULE}.rules
-LOADING_SCRIPT=load_hid_specific_module.sh
-BASH_LOADING_SCRIPT=/etc/udev/${LOADING_SCRIPT}
+MODPROBE_CONF=/etc/modprobe.d/${MODULE}.conf
+# hid-generic does not bind devices flagged HID_QUIRK_HAVE_SPECIAL_DRIVER
+HAVE_SPECIAL_DRIVER=0x80000
 
 if [[ `id -u` != 0 ]]
 then
@@ -12,26 +11,33 @@ then
   exit 1
 fi
 
+# left over by older installs, which rebound the devices from hid-generic
+rm -f /etc/udev/rules.d/99-${MODULE}.rules /etc/udev/load_hid_specific_module.sh
+
+# vendor:product of the USB ids, hid:b0003g*v0000VVVVp0000PPPP
+QUIRKS=`modinfo -F alias ${MODULE}.ko | \
+	sed -n "s/^hid:b0003g\*v0000\([0-9A-F]\{4\}\)p0000\([0-9A-F]\{4\}\)$/0x\1:0x\2:${HAVE_SPECIAL_DRIVER}/p" | \
+	sort -u | paste -sd,`
+
+cat > ${MODPROBE_CONF} <<EOC
+# installed by ${MODULE} install.sh, removed by restore.sh
+#
+# Register ${MODULE} before the HID transports enumerate their devices:
+# hid-generic then leaves the ones ${MODULE} matches alone.
+softdep usbhid pre: ${MODULE}
+softdep i2c_hid pre: ${MODULE}
+softdep hid_generic pre: ${MODULE}
+EOC
+
+if [[ -n ${QUIRKS} ]]
+then
+  cat >> ${MODPROBE_CONF} <<EOC
+# Keep hid-generic off the USB devices even before ${MODULE} is loaded.
+options usbhid quirks=${QUIRKS}
+EOC
+fi
 
-echo 'ACTION!="add|change", GOTO="hid_rmi_end"' > ${UDEV_RULE}
-grep MODULE_ALIAS ${MODULE}.mod.c | \
-	sed "s/MODULE_ALIAS(\"\(hid:b.*g.*v.*p.*\)\");/DRIVER==\"${BLACKLIST_MODULE}\", ENV{MODALIAS}==\"\1\", RUN+=\"\/bin\/sh \/etc\/udev\/${LOADING_SCRIPT} ${BLACKLIST_MODULE} ${MODULE} %k\"/" | \
-	grep -v MODULE_ALIAS | \
-	sort \
-		>> ${UDEV_RULE}
-echo 'LABEL="hid_rmi_end"' >> ${UDEV_RULE}
-
-cat > ${BASH_LOADING_SCRIPT} <<EOF
-#!/bin/bash
-
-BLACKLIST_DRIVER=\$1
-NEW_DRIVER=\$2
-DEVICE=\$3
-
-HID_DRV_PATH=/sys/bus/hid/drivers
-
-/sbin/modprobe \${NEW_DRIVER}
+echo "installed" ${MODPROBE_CONF}
 
-echo \${DEVICE} > \${HID_DRV_PATH}/\${BLACKLIST_DRIVER}/unbind
-echo \${DEVICE} > \${HID_DRV_PATH}/\${NEW_DRIVER}/bind
-EOF
+echo "depmod -a"
+depmod -a
@@ -1,6 +1,7 @@
 #!/bin/bash
 MODULE=$1
 
+MODPROBE_CONF=/etc/modprobe.d/${MODULE}.conf
 UDEV_RULE=/etc/udev/rules.d/99-${MODULE}.rules
 
 if [[ `id -u` != 0 ]]
@@ -11,7 +12,7 @@ fi
 
 TARGET=${MODULE}.ko
 
-INSTALL_PATH=/lib/modules/`uname -r`/extra
+INSTALL_PATH=/lib/modules/`uname -r`/updates
 
 INSTALLED_TARGET=`find ${INSTALL_PATH} -name ${TARGET}`
 if [[ -e ${INSTALLED_TARGET} ]]
@@ -20,6 +21,12 @@ then
   rm ${INSTALLED_TARGET}
 fi
 
+if [[ -e ${MODPROBE_CONF} ]]
+then
+  echo "removing modprobe configuration" ${MODPROBE_CONF}
+  rm ${MODPROBE_CONF}
+fi
+
 if [[ -e ${UDEV_RULE} ]]
 then
   echo "removing udev rule" ${UDEV_RULE}